@@ -1,6 +1,95 @@
 #pragma once
 
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
 namespace Cache{
+    // why an entry left the cache, handed to removal listeners
+    enum class RemovalCause {
+        Size,       // evicted to make room for a new entry
+        Expired,    // dropped because it was no longer valid
+        Explicit,   // removed by the caller
+        Replaced    // value overwritten by put on an existing key
+    };
+
+    // every cache and sharded wrapper takes one through setRemovalListener. It is
+    // called for each entry evicted, removed, replaced or dropped as stale, once the
+    // slice lock is released, so it may call back into the cache. Setting it is not
+    // synchronised: do that before the cache is shared between threads
+    template <typename Key, typename Value>
+    using RemovalListener = std::function<void(const Key&, const Value&, RemovalCause)>;
+
+    // what one locked operation drops, released after the lock is gone so a node
+    // (and a possibly large value) is never destroyed under the mutex. Most
+    // operations drop at most one entry, which is held inline: only a second one
+    // allocates, so the common eviction or overwrite adds no allocation under the lock
+    template <typename T> class RemovalList {
+        public:
+            class const_iterator {
+                public:
+                    using iterator_category = std::forward_iterator_tag;
+                    using value_type = T;
+                    using difference_type = std::ptrdiff_t;
+                    using pointer = const T*;
+                    using reference = const T&;
+
+                    const_iterator(const RemovalList* list, size_t index): list_(list), index_(index) {}
+                    const T& operator*() const {return index_ == 0 ? list_->first() : list_->rest_[index_ - 1];}
+                    const T* operator->() const {return &**this;}
+                    const_iterator& operator++() {++index_; return *this;}
+                    bool operator==(const const_iterator& other) const {return index_ == other.index_;}
+                    bool operator!=(const const_iterator& other) const {return index_ != other.index_;}
+
+                private:
+                    const RemovalList* list_;
+                    size_t index_;
+            };
+
+            RemovalList() = default;
+            RemovalList(const RemovalList&) = delete;
+            RemovalList& operator=(const RemovalList&) = delete;
+            ~RemovalList() {clear();}
+
+            template <typename... Args> void emplace_back(Args&&... args) {
+                if(!hasFirst_) {
+                    new (&first_) T(std::forward<Args>(args)...);
+                    hasFirst_ = true;
+                    return;
+                }
+                rest_.emplace_back(std::forward<Args>(args)...);
+            }
+
+            void push_back(T entry) {emplace_back(std::move(entry));}
+
+            size_t size() const {return hasFirst_ + rest_.size();}
+            const_iterator begin() const {return const_iterator(this, 0);}
+            const_iterator end() const {return const_iterator(this, size());}
+
+            void clear() {
+                if(hasFirst_) {
+                    first().~T();
+                    hasFirst_ = false;
+                }
+                rest_.clear();
+            }
+
+        private:
+            T& first() {return *reinterpret_cast<T*>(&first_);}
+            const T& first() const {return *reinterpret_cast<const T*>(&first_);}
+
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type first_;
+            bool hasFirst_ = false;
+            std::vector<T> rest_;   // only once more than one entry is dropped
+    };
+
+    template <typename NodePtr>
+    using RemovalBatch = RemovalList<std::pair<NodePtr, RemovalCause>>;
+
     template <typename Key, typename Value> class CachePolicy {
         public:
             virtual ~CachePolicy() = default;
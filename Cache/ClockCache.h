@@ -0,0 +1,601 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "CachePolicy.h"
+#include "Generation.h"
+#include "SliceParallel.h"
+
+namespace Cache{
+
+    // an entry moved out of a clock slot, destroyed/reported after the lock is released
+    template<typename Key, typename Value> struct ClockEvicted {
+        Key key;
+        Value value;
+        RemovalCause cause;
+    };
+
+    // CLOCK: entries live in a fixed ring of slots. A hit only sets the slot's atomic
+    // reference bit under a shared lock, so reads never relink anything and run in
+    // parallel; put takes the exclusive lock and sweeps the hand to find a victim
+    template<typename Key, typename Value> class ClockCache : public CachePolicy<Key, Value>, public GenerationTracker {
+        public:
+            using Listener = RemovalListener<Key, Value>;
+
+            ClockCache(int capacity, std::shared_ptr<GenerationTable> generations = nullptr)
+            : GenerationTracker(std::move(generations))
+            , capacity_(capacity > 0 ? capacity : 0)
+            , slots_(capacity_)
+            , hand_(0){
+                index_.reserve(capacity_);
+                freeSlots_.reserve(capacity_);
+                for(size_t i = capacity_; i > 0; i--) {
+                    freeSlots_.push_back(i - 1);
+                }
+            }
+            ~ClockCache() override = default;
+
+            void put(Key key, Value value) override {
+                put(key, value, kNoTag);
+            }
+
+            void put(Key key, Value value, CacheTag tag) {
+                if(capacity_ == 0) {return;}
+                Removals removed;
+                {
+                    std::unique_lock<std::shared_timed_mutex> lock(mutex_);
+                    syncGeneration(removed);
+                    putLocked(key, value, tag, removed);
+                }
+                notifyRemoved(removed);
+            }
+
+            bool get(Key key, Value& value) override {
+                std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+                if(generations_->current() != generation_) {
+                    return false;  // purged; the next writer reclaims the slots
+                }
+                auto it = index_.find(key);
+                if(it == index_.end()) {
+                    return false;
+                }
+                Slot& slot = slots_[it->second];
+                if(isStale(slot)) {
+                    return false;
+                }
+                // skip the store when already set so hot slots stay in shared cache state
+                if(!slot.referenced.load(std::memory_order_relaxed)) {
+                    slot.referenced.store(true, std::memory_order_relaxed);
+                }
+                value = slot.value;
+                return true;
+            }
+
+            Value get(Key key) override {
+                Value value{};
+                get(key, value);
+                return value;
+            }
+
+            bool remove(Key key) {
+                Removals removed;
+                bool found = false;
+                {
+                    std::unique_lock<std::shared_timed_mutex> lock(mutex_);
+                    syncGeneration(removed);
+                    auto it = index_.find(key);
+                    if(it != index_.end()) {
+                        Slot& slot = slots_[it->second];
+                        found = !isStale(slot);
+                        release(slot, found ? RemovalCause::Explicit : RemovalCause::Expired, removed);
+                        freeSlots_.push_back(it->second);
+                        index_.erase(it);
+                    }
+                }
+                notifyRemoved(removed);
+                return found;
+            }
+
+            void setRemovalListener(Listener listener) {
+                listener_ = std::move(listener);
+            }
+
+            // loads a range of (key, value) pairs under one exclusive lock
+            template<typename ForwardIt> void bulkLoad(ForwardIt first, ForwardIt last) {
+                if(capacity_ == 0) {return;}
+                Removals removed;
+                {
+                    std::unique_lock<std::shared_timed_mutex> lock(mutex_);
+                    syncGeneration(removed);
+                    for(; first != last; ++first) {
+                        const auto& entry = *first;
+                        putLocked(entry.first, entry.second, kNoTag, removed);
+                    }
+                }
+                notifyRemoved(removed);
+            }
+
+        private:
+            struct Slot : TagStamp {
+                Key key{};
+                Value value{};
+                std::atomic<bool> referenced{false};
+                bool occupied = false;
+                uint64_t generation = 0;    // global generation the slot was filled in
+            };
+
+            struct Removals {
+                RemovalList<ClockEvicted<Key, Value>> entries;
+                std::unordered_map<Key, size_t> purgedIndex;
+            };
+
+            void putLocked(const Key& key, const Value& value, CacheTag tag, Removals& removed) {
+                auto it = index_.find(key);
+                if(it != index_.end()) {
+                    Slot& slot = slots_[it->second];
+                    if(isStale(slot)) {
+                        release(slot, RemovalCause::Expired, removed);
+                    }
+                    else {
+                        removed.entries.push_back({slot.key, std::move(slot.value), RemovalCause::Replaced});
+                    }
+                    fill(slot, key, value, tag);
+                    slot.referenced.store(true, std::memory_order_relaxed);
+                    return;
+                }
+                size_t victim = takeFreeSlot(removed);
+                fill(slots_[victim], key, value, tag);
+                index_[key] = victim;
+            }
+
+            // slots emptied by remove() are reused before the hand evicts anything. The
+            // hand may also have taken a listed slot meanwhile, so occupied ones are skipped
+            size_t takeFreeSlot(Removals& removed) {
+                while(!freeSlots_.empty()) {
+                    size_t slot = freeSlots_.back();
+                    freeSlots_.pop_back();
+                    if(!slots_[slot].occupied) {
+                        return slot;
+                    }
+                }
+                return sweep(removed);
+            }
+
+            // advances the hand to a free, invalidated or unreferenced slot, clearing
+            // reference bits on the way; at most two passes over the ring
+            size_t sweep(Removals& removed) {
+                while(true) {
+                    size_t current = hand_;
+                    hand_ = (hand_ + 1) % capacity_;
+                    Slot& slot = slots_[current];
+                    if(!slot.occupied || slot.generation != generation_) {
+                        if(slot.occupied) {
+                            // left over from before a purge; its index entry went with the purge
+                            removed.entries.push_back({slot.key, std::move(slot.value), RemovalCause::Expired});
+                            slot.occupied = false;
+                        }
+                        return current;
+                    }
+                    if(isStale(slot)) {
+                        index_.erase(slot.key);
+                        release(slot, RemovalCause::Expired, removed);
+                        return current;
+                    }
+                    if(slot.referenced.load(std::memory_order_relaxed)) {
+                        slot.referenced.store(false, std::memory_order_relaxed);
+                        continue;
+                    }
+                    index_.erase(slot.key);
+                    release(slot, RemovalCause::Size, removed);
+                    return current;
+                }
+            }
+
+            void fill(Slot& slot, const Key& key, const Value& value, CacheTag tag) {
+                slot.key = key;
+                slot.value = value;
+                slot.referenced.store(false, std::memory_order_relaxed);
+                slot.occupied = true;
+                slot.generation = generation_;
+                stamp(slot, tag);
+            }
+
+            void release(Slot& slot, RemovalCause cause, Removals& removed) {
+                removed.entries.push_back({slot.key, std::move(slot.value), cause});
+                slot.value = Value{};
+                slot.occupied = false;
+            }
+
+            // a purge since our last write: drop the index in O(1); old slots are
+            // recognised by their generation and reclaimed as the hand reaches them
+            void syncGeneration(Removals& removed) {
+                if(catchUpGeneration()) {
+                    removed.purgedIndex.swap(index_);
+                }
+            }
+
+            void notifyRemoved(Removals& removed) {
+                if(listener_) {
+                    for(const auto& entry : removed.entries) {
+                        listener_(entry.key, entry.value, entry.cause);
+                    }
+                }
+                removed.entries.clear();
+                removed.purgedIndex.clear();
+            }
+
+        private:
+            size_t capacity_;
+            std::vector<Slot> slots_;
+            std::unordered_map<Key, size_t> index_;
+            std::vector<size_t> freeSlots_;     // emptied slots, used before sweeping
+            size_t hand_;
+            mutable std::shared_timed_mutex mutex_;
+            Listener listener_;
+    };
+
+    // CLOCK-Pro (Jiang, Chen, Zhang 2005): resident entries are hot or cold, and
+    // recently evicted cold keys stay behind as non-resident "test" entries. A cold
+    // entry referenced again is promoted to hot, a re-put of a test key comes back
+    // hot, and the cold share adapts: a re-put during the test period grows it, an
+    // expired test period shrinks it. Each kind sits on its own clock so a hand only
+    // walks the entries it acts on, and a test period lasts for the next capacity
+    // evictions. As with ClockCache a hit only sets the reference bit under a shared lock
+    template<typename Key, typename Value> class ClockProCache : public CachePolicy<Key, Value>, public GenerationTracker {
+        public:
+            using Listener = RemovalListener<Key, Value>;
+
+            ClockProCache(int capacity, std::shared_ptr<GenerationTable> generations = nullptr)
+            : GenerationTracker(std::move(generations))
+            , capacity_(capacity > 0 ? capacity : 0)
+            , coldTarget_(capacity_)
+            , countHot_(0)
+            , countCold_(0)
+            , countTest_(0){}
+            ~ClockProCache() override = default;
+
+            void put(Key key, Value value) override {
+                put(key, value, kNoTag);
+            }
+
+            void put(Key key, Value value, CacheTag tag) {
+                if(capacity_ == 0) {return;}
+                Removals removed;
+                {
+                    std::unique_lock<std::shared_timed_mutex> lock(mutex_);
+                    syncGeneration(removed);
+                    putLocked(key, value, tag, removed);
+                }
+                notifyRemoved(removed);
+            }
+
+            bool get(Key key, Value& value) override {
+                std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+                if(generations_->current() != generation_) {
+                    return false;
+                }
+                auto it = nodes_.find(key);
+                if(it == nodes_.end()) {
+                    return false;
+                }
+                Node& node = *it->second;
+                if(node.type == PageType::Test || isStale(node)) {
+                    return false;
+                }
+                if(!node.referenced.load(std::memory_order_relaxed)) {
+                    node.referenced.store(true, std::memory_order_relaxed);
+                }
+                value = node.value;
+                return true;
+            }
+
+            Value get(Key key) override {
+                Value value{};
+                get(key, value);
+                return value;
+            }
+
+            bool remove(Key key) {
+                Removals removed;
+                bool found = false;
+                {
+                    std::unique_lock<std::shared_timed_mutex> lock(mutex_);
+                    syncGeneration(removed);
+                    auto it = nodes_.find(key);
+                    if(it != nodes_.end()) {
+                        Node* node = it->second.get();
+                        if(node->type != PageType::Test) {
+                            found = !isStale(*node);
+                            removed.entries.push_back({node->key, std::move(node->value), found ? RemovalCause::Explicit : RemovalCause::Expired});
+                        }
+                        countOf(node->type)--;
+                        unlink(node);
+                        nodes_.erase(it);
+                    }
+                }
+                notifyRemoved(removed);
+                return found;
+            }
+
+            void setRemovalListener(Listener listener) {
+                listener_ = std::move(listener);
+            }
+
+            // loads a range of (key, value) pairs under one exclusive lock
+            template<typename ForwardIt> void bulkLoad(ForwardIt first, ForwardIt last) {
+                if(capacity_ == 0) {return;}
+                Removals removed;
+                {
+                    std::unique_lock<std::shared_timed_mutex> lock(mutex_);
+                    syncGeneration(removed);
+                    size_t incoming = static_cast<size_t>(std::distance(first, last));
+                    nodes_.reserve(std::min(2 * capacity_, nodes_.size() + incoming));
+                    for(; first != last; ++first) {
+                        const auto& entry = *first;
+                        putLocked(entry.first, entry.second, kNoTag, removed);
+                    }
+                }
+                notifyRemoved(removed);
+            }
+
+        private:
+            enum class PageType {Hot, Cold, Test};
+
+            // circular list hook; each clock is a sentinel Link, its hand is sentinel.next
+            struct Link {
+                Link* prev = this;
+                Link* next = this;
+            };
+
+            struct Node : Link, TagStamp {
+                Key key;
+                Value value;
+                std::atomic<bool> referenced{false};
+                PageType type = PageType::Cold;
+
+                Node(const Key& k, const Value& v): key(k), value(v) {}
+            };
+
+            using NodeMap = std::unordered_map<Key, std::unique_ptr<Node>>;
+
+            struct Removals {
+                RemovalList<ClockEvicted<Key, Value>> entries;
+                NodeMap purged;
+            };
+
+            void putLocked(const Key& key, const Value& value, CacheTag tag, Removals& removed) {
+                auto it = nodes_.find(key);
+                if(it != nodes_.end() && it->second->type != PageType::Test) {
+                    Node* node = it->second.get();
+                    removed.entries.push_back({node->key, std::move(node->value), isStale(*node) ? RemovalCause::Expired : RemovalCause::Replaced});
+                    node->value = value;
+                    stamp(*node, tag);
+                    node->referenced.store(true, std::memory_order_relaxed);
+                    return;
+                }
+
+                evict(removed);
+                // eviction may have expired the test entry we found
+                it = nodes_.find(key);
+                if(it == nodes_.end()) {
+                    std::unique_ptr<Node> owned(new Node(key, value));
+                    Node* node = owned.get();
+                    stamp(*node, tag);
+                    nodes_.emplace(key, std::move(owned));
+                    pushBack(cold_, node, PageType::Cold);
+                    return;
+                }
+
+                // re-put during the test period: the cold share was too small
+                if(coldTarget_ < capacity_) {
+                    coldTarget_++;
+                }
+                Node* node = it->second.get();
+                countTest_--;
+                unlink(node);
+                node->value = value;
+                node->referenced.store(false, std::memory_order_relaxed);
+                stamp(*node, tag);
+                pushBack(hot_, node, PageType::Hot);
+            }
+
+            // makes room for one resident entry. the hot hand runs first so the hot
+            // share is within capacity_ - coldTarget_ (< capacity_), which leaves the
+            // cold hand at least one cold entry to act on
+            void evict(Removals& removed) {
+                while(countHot_ + countCold_ >= capacity_) {
+                    while(countHot_ > capacity_ - coldTarget_) {
+                        runHandHot();
+                    }
+                    runHandCold(removed);
+                    while(countTest_ > capacity_) {
+                        runHandTest();
+                    }
+                }
+            }
+
+            void runHandCold(Removals& removed) {
+                Node* node = static_cast<Node*>(cold_.next);
+                unlink(node);
+                countCold_--;
+                if(node->referenced.load(std::memory_order_relaxed) && !isStale(*node)) {
+                    node->referenced.store(false, std::memory_order_relaxed);
+                    pushBack(hot_, node, PageType::Hot);
+                    return;
+                }
+                // evict the value but keep the key as a test entry
+                removed.entries.push_back({node->key, std::move(node->value), isStale(*node) ? RemovalCause::Expired : RemovalCause::Size});
+                node->value = Value{};
+                pushBack(test_, node, PageType::Test);
+            }
+
+            void runHandHot() {
+                Node* node = static_cast<Node*>(hot_.next);
+                unlink(node);
+                countHot_--;
+                if(node->referenced.load(std::memory_order_relaxed) && !isStale(*node)) {
+                    node->referenced.store(false, std::memory_order_relaxed);
+                    pushBack(hot_, node, PageType::Hot);
+                    return;
+                }
+                pushBack(cold_, node, PageType::Cold);
+            }
+
+            void runHandTest() {
+                // test period ran out without a re-put: the cold share was too large
+                Node* node = static_cast<Node*>(test_.next);
+                if(coldTarget_ > 1) {
+                    coldTarget_--;
+                }
+                countTest_--;
+                unlink(node);
+                nodes_.erase(nodes_.find(node->key));
+            }
+
+            // appends behind the hand, i.e. the entry is looked at last
+            void pushBack(Link& clock, Node* node, PageType type) {
+                node->type = type;
+                node->prev = clock.prev;
+                node->next = &clock;
+                clock.prev->next = node;
+                clock.prev = node;
+                countOf(type)++;
+            }
+
+            static void unlink(Link* node) {
+                node->prev->next = node->next;
+                node->next->prev = node->prev;
+                node->prev = node->next = node;
+            }
+
+            size_t& countOf(PageType type) {
+                return type == PageType::Hot ? countHot_ : type == PageType::Cold ? countCold_ : countTest_;
+            }
+
+            // a purge since our last write: hand every node to the batch in O(1)
+            void syncGeneration(Removals& removed) {
+                if(!catchUpGeneration()) {
+                    return;
+                }
+                removed.purged.swap(nodes_);
+                for(Link* clock : {&hot_, &cold_, &test_}) {
+                    clock->prev = clock->next = clock;
+                }
+                countHot_ = countCold_ = countTest_ = 0;
+                coldTarget_ = capacity_;
+            }
+
+            void notifyRemoved(Removals& removed) {
+                if(listener_) {
+                    for(const auto& entry : removed.entries) {
+                        listener_(entry.key, entry.value, entry.cause);
+                    }
+                    for(const auto& entry : removed.purged) {
+                        if(entry.second->type != PageType::Test) {
+                            listener_(entry.first, entry.second->value, RemovalCause::Expired);
+                        }
+                    }
+                }
+                removed.entries.clear();
+                removed.purged.clear();
+            }
+
+        private:
+            size_t capacity_;
+            size_t coldTarget_;     // resident entries the cold share may hold
+            size_t countHot_;
+            size_t countCold_;
+            size_t countTest_;
+            Link hot_;
+            Link cold_;
+            Link test_;
+            NodeMap nodes_;
+            mutable std::shared_timed_mutex mutex_;
+            Listener listener_;
+    };
+
+    // sharded CLOCK / CLOCK-Pro with the same interface as HashLruCaches
+    template<typename Key, typename Value, template<typename, typename> class Slice = ClockCache> class HashClockCache {
+        public:
+            using Listener = RemovalListener<Key, Value>;
+
+            HashClockCache(size_t capacity, int sliceNum)
+            : capacity_(capacity)
+            , sliceNum_(sliceNum > 0 ? sliceNum : std::thread::hardware_concurrency())
+            , generations_(std::make_shared<GenerationTable>()){
+                size_t sliceSize = std::ceil(capacity / static_cast<double>(sliceNum_));
+                for(int i = 0; i < sliceNum_; i++) {
+                    clockSliceCaches_.emplace_back(new Slice<Key, Value>(sliceSize, generations_));
+                }
+            }
+
+            void put(Key key, Value value, CacheTag tag = kNoTag) {
+                size_t sliceIndex = Hash(key)% sliceNum_;
+                clockSliceCaches_[sliceIndex]->put(key, value, tag);
+            }
+
+            bool get(Key key, Value& value) {
+                size_t sliceIndex = Hash(key)% sliceNum_;
+                return clockSliceCaches_[sliceIndex]->get(key, value);
+            }
+
+            Value get(Key key) {
+                Value value{};
+                get(key, value);
+                return value;
+            }
+
+            bool remove(Key key) {
+                size_t sliceIndex = Hash(key)% sliceNum_;
+                return clockSliceCaches_[sliceIndex]->remove(key);
+            }
+
+            void purge() {
+                generations_->purge();
+            }
+
+            void invalidateTag(CacheTag tag) {
+                generations_->invalidate(tag);
+            }
+
+            // partitions the range by slice, then loads every slice in parallel
+            template<typename ForwardIt> void bulkLoad(ForwardIt first, ForwardIt last) {
+                auto parts = partitionBySlice(first, last, sliceNum_, [this](const Key& key) {return Hash(key) % sliceNum_;});
+                forEachSliceParallel(sliceNum_, [&](size_t sliceIndex) {
+                    const auto& part = parts[sliceIndex];
+                    clockSliceCaches_[sliceIndex]->bulkLoad(IndirectIterator<ForwardIt>(part.begin()), IndirectIterator<ForwardIt>(part.end()));
+                });
+            }
+
+            void setRemovalListener(Listener listener) {
+                for(auto& clockSliceCache : clockSliceCaches_) {
+                    clockSliceCache->setRemovalListener(listener);
+                }
+            }
+
+        private:
+            size_t Hash(Key key) {
+                std::hash<Key> hashFunc;
+                return hashFunc(key);
+            }
+
+        private:
+            size_t capacity_;
+            int sliceNum_;
+            std::shared_ptr<GenerationTable> generations_;
+            std::vector<std::unique_ptr<Slice<Key,Value>>> clockSliceCaches_;
+    };
+
+    template<typename Key, typename Value> using HashClockProCache = HashClockCache<Key, Value, ClockProCache>;
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace Cache{
+    // optional label on an entry (e.g. a hashed tenant id) for bulk invalidation
+    using CacheTag = uint64_t;
+    const CacheTag kNoTag = 0;
+
+    // generation counters shared by every slice of a cache. purge() and invalidate()
+    // are a single atomic increment; slices compare against them lazily, so stale
+    // entries read as misses and are reclaimed by whichever operation finds them.
+    // The tag counters, and a short log of which slots were invalidated, are
+    // allocated by the first invalidate(); until then every tag is at generation 0
+    class GenerationTable {
+        public:
+            GenerationTable() = default;
+            GenerationTable(const GenerationTable&) = delete;
+            GenerationTable& operator=(const GenerationTable&) = delete;
+            ~GenerationTable() {delete tags_.load();}
+
+            uint64_t current() const {return generation_.load(std::memory_order_acquire);}
+
+            // tags share kTagSlots counters, so invalidating one tag may also drop
+            // entries of another tag in the same slot; it never keeps a stale one
+            static size_t tagSlot(CacheTag tag) {return tag % kTagSlots;}
+
+            uint64_t tagGeneration(CacheTag tag) const {
+                if(tag == kNoTag) {
+                    return 0;
+                }
+                const TagTable* tags = tags_.load(std::memory_order_acquire);
+                return tags ? tags->generations[tagSlot(tag)].load(std::memory_order_acquire) : 0;
+            }
+
+            // bumped by every invalidate()
+            uint64_t invalidations() const {return invalidations_.load(std::memory_order_acquire);}
+
+            // calls fn(slot) for the tag slot of every invalidate() after the first seen
+            // ones, oldest first, and moves seen past them. One still being logged ends
+            // the walk until the next call. Returns false when some already fell out of
+            // the log: seen is then caught up and any slot may have changed
+            template<typename Fn> bool forEachInvalidatedSlot(uint64_t& seen, Fn fn) const {
+                uint64_t latest = invalidations();
+                if(seen == latest) {
+                    return true;
+                }
+                const TagTable* tags = tags_.load(std::memory_order_acquire);
+                for(; seen < latest; seen++) {
+                    uint64_t entry = tags->recent[seen % kRecentSlots].load(std::memory_order_acquire);
+                    uint64_t sequence = entry / kTagSlots;
+                    if(sequence == seen + 1) {
+                        fn(static_cast<size_t>(entry % kTagSlots));
+                    }
+                    else if(sequence > seen + 1) {
+                        seen = latest;
+                        return false;
+                    }
+                    else {
+                        break;
+                    }
+                }
+                return true;
+            }
+
+            void purge() {generation_.fetch_add(1, std::memory_order_acq_rel);}
+
+            void invalidate(CacheTag tag) {
+                if(tag == kNoTag) {
+                    return;
+                }
+                TagTable* tags = tagTable();
+                size_t slot = tagSlot(tag);
+                tags->generations[slot].fetch_add(1, std::memory_order_acq_rel);
+                uint64_t sequence = invalidations_.fetch_add(1, std::memory_order_acq_rel);
+                // entries only move forward, so a late writer can't hide a newer one
+                uint64_t entry = (sequence + 1) * kTagSlots + slot;
+                std::atomic<uint64_t>& logged = tags->recent[sequence % kRecentSlots];
+                uint64_t previous = logged.load(std::memory_order_relaxed);
+                while(previous < entry && !logged.compare_exchange_weak(previous, entry, std::memory_order_acq_rel)) {}
+            }
+
+        private:
+            static const size_t kTagSlots = 4096;
+            static const size_t kRecentSlots = 256;
+
+            struct TagTable {
+                std::atomic<uint64_t> generations[kTagSlots];
+                std::atomic<uint64_t> recent[kRecentSlots];    // (sequence + 1) * kTagSlots + slot
+            };
+
+            TagTable* tagTable() {
+                TagTable* tags = tags_.load(std::memory_order_acquire);
+                if(tags) {
+                    return tags;
+                }
+                TagTable* created = new TagTable();
+                if(tags_.compare_exchange_strong(tags, created, std::memory_order_acq_rel)) {
+                    return created;
+                }
+                delete created;     // another thread got there first
+                return tags;
+            }
+
+            std::atomic<uint64_t> generation_{0};
+            std::atomic<uint64_t> invalidations_{0};
+            std::atomic<TagTable*> tags_{nullptr};
+    };
+
+    // what an entry was written with: its tag and that tag's generation at the time
+    struct TagStamp {
+        CacheTag tag = kNoTag;
+        uint64_t tagGeneration = 0;
+    };
+
+    // base of every cache policy that can be purged or invalidated by tag. The
+    // checks below run under the cache's own lock; what a purge drops is up to it
+    class GenerationTracker {
+        public:
+            // O(1): every current entry becomes a miss and is reclaimed lazily
+            void purge() {generations_->purge();}
+
+            // O(1): entries put with this tag become misses and are reclaimed lazily
+            void invalidateTag(CacheTag tag) {generations_->invalidate(tag);}
+
+        protected:
+            // slices of a sharded cache pass one shared table so purge/invalidateTag hit them all
+            explicit GenerationTracker(std::shared_ptr<GenerationTable> generations)
+            : generations_(generations ? std::move(generations) : std::make_shared<GenerationTable>())
+            , generation_(generations_->current()) {}
+
+            // true once for each purge the cache hasn't caught up with yet
+            bool catchUpGeneration() {
+                uint64_t generation = generations_->current();
+                if(generation == generation_) {
+                    return false;
+                }
+                generation_ = generation;
+                return true;
+            }
+
+            bool isStale(const TagStamp& entry) const {
+                return entry.tag != kNoTag && entry.tagGeneration != generations_->tagGeneration(entry.tag);
+            }
+
+            void stamp(TagStamp& entry, CacheTag tag) const {
+                entry.tag = tag;
+                entry.tagGeneration = generations_->tagGeneration(tag);
+            }
+
+            std::shared_ptr<GenerationTable> generations_;
+            uint64_t generation_;       // last global generation this cache has caught up with
+    };
+}
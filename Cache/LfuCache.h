@@ -1,20 +1,27 @@
 #pragma once
 
+#include<climits>
 #include<cmath>
+#include<cstdint>
+#include<iterator>
 #include<memory>
 #include<mutex>
 #include<unordered_map>
+#include<utility>
 #include<vector>
 #include<thread>
+#include<type_traits>
 
 #include "CachePolicy.h"
+#include "Generation.h"
+#include "SliceParallel.h"
 
 
 namespace Cache{
     template<typename Key, typename Value> class LfuCache;
     template<typename Key, typename Value> class FreqList {
         private:
-            struct Node{
+            struct Node : TagStamp {
                 int freq;
                 Key key;
                 Value value;
@@ -38,6 +45,15 @@ namespace Cache{
                 tail_->pre = head_;
             }
 
+            ~FreqList() {
+                // unlink iteratively, letting the next chain destroy itself recurses once per node
+                NodePtr node = std::move(head_);
+                while(node) {
+                    NodePtr next = std::move(node->next);
+                    node = std::move(next);
+                }
+            }
+
             bool isEmpty() const {
                 return head_->next == tail_;
             }
@@ -71,37 +87,68 @@ namespace Cache{
     };
 
 
-    template<typename Key, typename Value> class LfuCache : public CachePolicy<Key, Value> {
+    template<typename Key, typename Value> class LfuCache : public CachePolicy<Key, Value>, public GenerationTracker {
         public:
             using Node = typename FreqList<Key, Value>::Node;
             using NodePtr = std::shared_ptr<Node>;
             using NodeMap = std::unordered_map<Key, NodePtr>;
+            using Listener = RemovalListener<Key, Value>;
+            using FreqListMap = std::unordered_map<int, std::unique_ptr<FreqList<Key, Value>>>;
 
-            LfuCache(int capacity, int maxAverageNum = 1000000): capacity_(capacity), minFreq_(INT8_MAX), maxAverageNum_(maxAverageNum), curAverageNum_(0),curTotalNum_(0) {}
+            LfuCache(int capacity, int maxAverageNum = 1000000, std::shared_ptr<GenerationTable> generations = nullptr)
+            : GenerationTracker(std::move(generations))
+            , capacity_(capacity), minFreq_(INT_MAX), maxAverageNum_(maxAverageNum), curAverageNum_(0),curTotalNum_(0)
+            , seenInvalidations_(generations_->invalidations()) {}
             ~LfuCache() override = default;
 
             void put(Key key, Value value) override {
+                put(key, value, kNoTag);
+            }
+
+            void put(Key key, Value value, CacheTag tag) {
                 if(capacity_ == 0) {
                     return;
                 }
-                std::lock_guard<std::mutex> lock(mutex_);
-                auto it = NodeMap_.find(key);
-                if(it != NodeMap_.end()) {
-                    it->second->value = value;
-                    getInternal(it->second, value);
-                    return;
+                Removals removed;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    syncGeneration(removed);
+                    auto it = NodeMap_.find(key);
+                    if(it != NodeMap_.end() && isStale(*it->second)) {
+                        dropNode(it, RemovalCause::Expired, removed);
+                        it = NodeMap_.end();
+                    }
+                    if(it != NodeMap_.end()) {
+                        replaceValue(it->second, value, removed);
+                        stamp(it->second, tag);
+                        getInternal(it->second, value, removed);
+                    }
+                    else {
+                        putInternal(key, value, tag, removed);
+                    }
                 }
-                putInternal(key, value);
+                notifyRemoved(removed);
             }
 
             bool get(Key key, Value& value) override {
-                std::lock_guard<std::mutex> lock(mutex_);
-                auto it = NodeMap_.find(key);
-                if(it!= NodeMap_.end()) {
-                    getInternal(it->second, value);
-                    return true;
+                Removals removed;
+                bool found = false;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    syncGeneration(removed);
+                    auto it = NodeMap_.find(key);
+                    if(it!= NodeMap_.end()) {
+                        if(isStale(*it->second)) {
+                            dropNode(it, RemovalCause::Expired, removed);
+                        }
+                        else {
+                            getInternal(it->second, value, removed);
+                            found = true;
+                        }
+                    }
                 }
-                return false;
+                notifyRemoved(removed);
+                return found;
             }
 
             Value get(Key key) override {
@@ -110,24 +157,74 @@ namespace Cache{
                 return value;
             }
 
-            void purge(){
-                NodeMap_.clear();
-                freqToFreqList_.clear();
+            bool remove(Key key) {
+                Removals removed;
+                bool found = false;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    syncGeneration(removed);
+                    auto it = NodeMap_.find(key);
+                    if(it != NodeMap_.end()) {
+                        found = !isStale(*it->second);
+                        dropNode(it, found ? RemovalCause::Explicit : RemovalCause::Expired, removed);
+                    }
+                }
+                notifyRemoved(removed);
+                return found;
+            }
+
+            void setRemovalListener(Listener listener) {
+                listener_ = std::move(listener);
             }
 
+            // loads a range of (key, value) pairs under one lock, all with frequency 1;
+            // within a frequency the earlier entries are evicted first
+            template<typename ForwardIt> void bulkLoad(ForwardIt first, ForwardIt last) {
+                bulkLoad(first, last, [](const Key&, const Value&) {return 1;});
+            }
+
+            // same, with initialFreq(key, value) giving each entry's starting frequency,
+            // clamped to [1, maxAverageNum]
+            template<typename ForwardIt, typename FreqFn> void bulkLoad(ForwardIt first, ForwardIt last, FreqFn initialFreq);
+
         private:
-            void putInternal(Key key, Value value);  // add cache
-            void getInternal(NodePtr node, Value& value); // get cache
+            struct Removals {
+                RemovalBatch<NodePtr> nodes;
+                RemovalList<std::pair<Key, Value>> replaced;    // old values of overwritten entries
+                NodeMap purged;             // whole cache dropped after a purge
+                FreqListMap purgedLists;
+            };
+
+            void putInternal(Key key, Value value, CacheTag tag, Removals& removed);  // add cache
+            void getInternal(NodePtr node, Value& value, Removals& removed); // get cache
             
-            void kickOut();  // move expired data
+            void kickOut(Removals& removed);  // move expired data
+            void reclaimStale(Removals& removed);  // drop invalidated entries when an invalidateTag concerns us
+            void notifyRemoved(Removals& removed); // runs after unlock
+
+            void syncGeneration(Removals& removed);    // catch up with a purge in O(1)
+            void stamp(const NodePtr& node, CacheTag tag);  // also keeps taggedSlots_ current
+            void dropNode(typename NodeMap::iterator it, RemovalCause cause, Removals& removed);
+            void replaceValue(const NodePtr& node, const Value& value, Removals& removed);
+            void trackTag(CacheTag tag);    // taggedSlots_ bookkeeping
+            void untrackTag(CacheTag tag);
 
             void removeFromFreqList(NodePtr node);
             void addToFreqList(NodePtr node);
 
-            void addFreqNum();   // add avg access freq
+            void addFreqNum(Removals& removed);   // add avg access freq
             void decreaseFreqNum(int num);  // decrease avg acess freq
-            void handleOverMaxAverageNum(); // handle cur acess freq over upper bound
+            void handleOverMaxAverageNum(Removals& removed); // handle cur acess freq over upper bound
             void updateMinFreq();
+            int averageFreq() const {
+                return NodeMap_.empty() ? 0 : static_cast<int>(curTotalNum_ / static_cast<int64_t>(NodeMap_.size()));
+            }
+            // a loaded frequency above maxAverageNum_ would only trigger aging straight away
+            template<typename Freq> int clampFreq(Freq freq) const {
+                int upper = std::max(1, maxAverageNum_);
+                return freq < 1 ? 1 : freq > upper ? upper : static_cast<int>(freq);
+            }
+            void ensureMinFreq();   // repair minFreq_ if its list has been emptied
 
 
 
@@ -136,14 +233,17 @@ namespace Cache{
             int minFreq_;
             int maxAverageNum_;
             int curAverageNum_;
-            int curTotalNum_;
+            int64_t curTotalNum_;       // sum of all frequencies, wider than one int frequency
             std::mutex mutex_;
             NodeMap NodeMap_;
-            std::unordered_map<int, FreqList<Key,Value>*> freqToFreqList_;
+            FreqListMap freqToFreqList_;
+            Listener listener_;
+            uint64_t seenInvalidations_;    // invalidations already checked against taggedSlots_
+            std::unordered_map<size_t, size_t> taggedSlots_;   // tag slot -> entries in it; only these can go stale
 
     };
 
-    template<typename Key, typename Value> void LfuCache<Key, Value>::getInternal(NodePtr node, Value& value) {
+    template<typename Key, typename Value> void LfuCache<Key, Value>::getInternal(NodePtr node, Value& value, Removals& removed) {
         value = node->value;
         removeFromFreqList(node);
         node->freq++;
@@ -151,27 +251,186 @@ namespace Cache{
         if(node->freq - 1 == minFreq_ && freqToFreqList_[node->freq -1]->isEmpty()) {
             minFreq_++;
         }
-        addFreqNum();
+        addFreqNum(removed);
     }
 
-    template<typename Key, typename Value> void LfuCache<Key, Value>::putInternal(Key key, Value value) {
+    template<typename Key, typename Value> void LfuCache<Key, Value>::putInternal(Key key, Value value, CacheTag tag, Removals& removed) {
         // if not in cache, check if cache is full
-        if(NodeMap_.size() == capacity_) {
+        if(NodeMap_.size() >= static_cast<size_t>(capacity_)) {
+            reclaimStale(removed);
+        }
+        if(NodeMap_.size() >= static_cast<size_t>(capacity_)) {
             // if the cache is full, delete least freq used and update avg access and total access
-            kickOut();
+            kickOut(removed);
         }
         NodePtr node = std::make_shared<Node>(key, value);
+        stamp(node, tag);
         NodeMap_[key] = node;
         addToFreqList(node);
-        addFreqNum();
+        addFreqNum(removed);
         minFreq_ = std::min(minFreq_, 1);
     }
 
-    template<typename Key, typename Value> void LfuCache<Key, Value>::kickOut() {
+    template<typename Key, typename Value> void LfuCache<Key, Value>::kickOut(Removals& removed) {
+        ensureMinFreq();
         NodePtr node = freqToFreqList_[minFreq_]->getFirstNode();
         removeFromFreqList(node);
         NodeMap_.erase(node->key);
         decreaseFreqNum(node->freq);
+        untrackTag(node->tag);
+        removed.nodes.emplace_back(node, isStale(*node) ? RemovalCause::Expired : RemovalCause::Size);
+    }
+
+    // a stale entry keeps the frequency it had, so LFU order alone may never pick it.
+    // Before evicting live data a full cache looks at the tag slots invalidated since
+    // its last check, and sweeps only if it holds entries in one of them
+    template<typename Key, typename Value> void LfuCache<Key, Value>::reclaimStale(Removals& removed) {
+        bool concerned = false;
+        bool logged = generations_->forEachInvalidatedSlot(seenInvalidations_, [this, &concerned](size_t slot) {
+            concerned = concerned || taggedSlots_.count(slot) > 0;
+        });
+        if(!logged) {
+            concerned = !taggedSlots_.empty();
+        }
+        if(!concerned) {
+            return;
+        }
+        for(auto it = NodeMap_.begin(); it != NodeMap_.end();) {
+            if(isStale(*it->second)) {
+                dropNode(it++, RemovalCause::Expired, removed);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    template<typename Key, typename Value> void LfuCache<Key, Value>::syncGeneration(Removals& removed) {
+        if(!catchUpGeneration() || NodeMap_.empty()) {
+            return;
+        }
+        removed.purged.swap(NodeMap_);
+        removed.purgedLists.swap(freqToFreqList_);
+        taggedSlots_.clear();
+        minFreq_ = INT_MAX;
+        curTotalNum_ = 0;
+        curAverageNum_ = 0;
+    }
+
+    template<typename Key, typename Value> void LfuCache<Key, Value>::stamp(const NodePtr& node, CacheTag tag) {
+        untrackTag(node->tag);
+        trackTag(tag);
+        GenerationTracker::stamp(*node, tag);
+    }
+
+    template<typename Key, typename Value> void LfuCache<Key, Value>::dropNode(typename NodeMap::iterator it, RemovalCause cause, Removals& removed) {
+        NodePtr node = it->second;
+        removeFromFreqList(node);
+        NodeMap_.erase(it);
+        decreaseFreqNum(node->freq);
+        untrackTag(node->tag);
+        removed.nodes.emplace_back(node, cause);
+    }
+
+    template<typename Key, typename Value> void LfuCache<Key, Value>::trackTag(CacheTag tag) {
+        if(tag != kNoTag) {
+            taggedSlots_[GenerationTable::tagSlot(tag)]++;
+        }
+    }
+
+    template<typename Key, typename Value> void LfuCache<Key, Value>::untrackTag(CacheTag tag) {
+        if(tag == kNoTag) {
+            return;
+        }
+        auto it = taggedSlots_.find(GenerationTable::tagSlot(tag));
+        if(--it->second == 0) {
+            taggedSlots_.erase(it);
+        }
+    }
+
+    template<typename Key, typename Value> void LfuCache<Key, Value>::replaceValue(const NodePtr& node, const Value& value, Removals& removed) {
+        if(listener_ || !std::is_trivially_destructible<Value>::value) {
+            // move the old value out so it is destroyed after unlock
+            removed.replaced.emplace_back(node->key, std::move(node->value));
+        }
+        node->value = value;
+    }
+
+    template<typename Key, typename Value>
+    template<typename ForwardIt, typename FreqFn>
+    void LfuCache<Key, Value>::bulkLoad(ForwardIt first, ForwardIt last, FreqFn initialFreq) {
+        if(capacity_ == 0) {
+            return;
+        }
+        Removals removed;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            syncGeneration(removed);
+            size_t incoming = static_cast<size_t>(std::distance(first, last));
+            NodeMap_.reserve(std::min(static_cast<size_t>(capacity_), NodeMap_.size() + incoming));
+            for(; first != last; ++first) {
+                const auto& entry = *first;
+                int freq = clampFreq(initialFreq(entry.first, entry.second));
+                auto it = NodeMap_.find(entry.first);
+                if(it != NodeMap_.end() && isStale(*it->second)) {
+                    dropNode(it, RemovalCause::Expired, removed);
+                    it = NodeMap_.end();
+                }
+                if(it != NodeMap_.end()) {
+                    NodePtr node = it->second;
+                    replaceValue(node, entry.second, removed);
+                    stamp(node, kNoTag);
+                    if(freq > node->freq) {
+                        removeFromFreqList(node);
+                        curTotalNum_ += freq - node->freq;
+                        node->freq = freq;
+                        addToFreqList(node);
+                    }
+                    continue;
+                }
+                if(NodeMap_.size() >= static_cast<size_t>(capacity_)) {
+                    reclaimStale(removed);
+                }
+                if(NodeMap_.size() >= static_cast<size_t>(capacity_)) {
+                    ensureMinFreq();
+                    if(freq < minFreq_) {
+                        continue;  // it would be the next victim anyway
+                    }
+                    kickOut(removed);
+                }
+                NodePtr node = std::make_shared<Node>(entry.first, entry.second);
+                node->freq = freq;
+                NodeMap_[entry.first] = node;
+                addToFreqList(node);
+                curTotalNum_ += freq;
+                minFreq_ = std::min(minFreq_, freq);
+            }
+            // aging is checked once for the whole load instead of once per entry
+            curAverageNum_ = averageFreq();
+            if(curAverageNum_ > maxAverageNum_) {
+                handleOverMaxAverageNum(removed);
+            }
+        }
+        notifyRemoved(removed);
+    }
+
+    template<typename Key, typename Value> void LfuCache<Key, Value>::notifyRemoved(Removals& removed) {
+        // the batch holds the last references, so nodes are freed here, outside the lock
+        if(listener_) {
+            for(const auto& entry : removed.nodes) {
+                listener_(entry.first->key, entry.first->value, entry.second);
+            }
+            for(const auto& entry : removed.replaced) {
+                listener_(entry.first, entry.second, RemovalCause::Replaced);
+            }
+            for(const auto& entry : removed.purged) {
+                listener_(entry.second->key, entry.second->value, RemovalCause::Expired);
+            }
+        }
+        removed.nodes.clear();
+        removed.replaced.clear();
+        removed.purgedLists.clear();
+        removed.purged.clear();
     }
 
     template<typename Key, typename Value> void LfuCache<Key, Value>::removeFromFreqList(NodePtr node) {
@@ -190,86 +449,99 @@ namespace Cache{
         //check if freqList exist before adding
         auto freq = node->freq;
         if(freqToFreqList_.find(node->freq) == freqToFreqList_.end()) {
-            freqToFreqList_[node->freq] = new FreqList<Key, Value>(node->freq);
+            freqToFreqList_[node->freq].reset(new FreqList<Key, Value>(node->freq));
         }
         freqToFreqList_[freq]->addNode(node);
     }
 
-    template<typename Key, typename Value> void LfuCache<Key, Value>::addFreqNum(){
+    template<typename Key, typename Value> void LfuCache<Key, Value>::addFreqNum(Removals& removed){
         curTotalNum_++;
-        if(NodeMap_.empty()){
-            curAverageNum_ = 0;
-        }
-        else {
-            curAverageNum_ = curTotalNum_ / NodeMap_.size();
-        }
+        curAverageNum_ = averageFreq();
         if(curAverageNum_>maxAverageNum_){
-            handleOverMaxAverageNum();
+            handleOverMaxAverageNum(removed);
         }
     }
 
     template<typename Key, typename Value> void LfuCache<Key, Value>::decreaseFreqNum(int num) {
         curTotalNum_ -= num;
-        if(NodeMap_.empty()) {
-            curAverageNum_ = 0;
-        }
-        else {
-            curAverageNum_ = curTotalNum_ / NodeMap_.size();
-        }
+        curAverageNum_ = averageFreq();
     }
 
-    template<typename Key, typename Value> void LfuCache<Key, Value>::handleOverMaxAverageNum() {
+    template<typename Key, typename Value> void LfuCache<Key, Value>::handleOverMaxAverageNum(Removals& removed) {
         if(NodeMap_.empty()) {
             return;
         }
 
-        for(auto it = NodeMap_.begin(); it !=NodeMap_.end(); it++) {
+        // the rescan already visits every node, so it also reclaims invalidated ones
+        // that LFU order would otherwise keep around
+        curTotalNum_ = 0;
+        for(auto it = NodeMap_.begin(); it !=NodeMap_.end();) {
             if(!it->second) {
+                it++;
                 continue;
             }
             NodePtr node = it->second;
             removeFromFreqList(node);
+            if(isStale(*node)) {
+                untrackTag(node->tag);
+                removed.nodes.emplace_back(node, RemovalCause::Expired);
+                it = NodeMap_.erase(it);
+                continue;
+            }
 
             node->freq -= maxAverageNum_ /2;
             if(node->freq < 1) {
                 node->freq = 1;
             }
             addToFreqList(node);
+            curTotalNum_ += node->freq;
+            it++;
         }
+        curAverageNum_ = averageFreq();
         updateMinFreq();
     }
 
     template<typename Key, typename Value> void LfuCache<Key, Value>::updateMinFreq() {
-        minFreq_ = INT8_MAX;
+        minFreq_ = INT_MAX;
         for(const auto& pair : freqToFreqList_) {
             if(pair.second && !pair.second->isEmpty()) {
                 minFreq_ = std::min(minFreq_, pair.first);
             }
         }
-        if(minFreq_ == INT8_MAX) {
+        if(minFreq_ == INT_MAX) {
             minFreq_ =1;
         }
     }
 
+    template<typename Key, typename Value> void LfuCache<Key, Value>::ensureMinFreq() {
+        auto it = freqToFreqList_.find(minFreq_);
+        if(it == freqToFreqList_.end() || !it->second || it->second->isEmpty()) {
+            updateMinFreq();
+        }
+    }
+
 
     template<typename Key, typename Value> class HashLfuCache {
         public:
+            using Listener = RemovalListener<Key, Value>;
+
             HashLfuCache(size_t capacity, int sliceNum, int maxAverageNum = 10)
             : sliceNum_(sliceNum > 0 ? sliceNum : std::thread::hardware_concurrency())
-            , capacity_(capacity){
+            , capacity_(capacity)
+            , generations_(std::make_shared<GenerationTable>()){
                 size_t sliceSize = std::ceil(capacity_ / static_cast<double>(sliceNum_)); 
                 for (int i = 0; i < sliceNum_; i++)
                 {
-                    lfuSliceCaches_.emplace_back(new LfuCache<Key, Value>(sliceSize, maxAverageNum));
+                    lfuSliceCaches_.emplace_back(new LfuCache<Key, Value>(sliceSize, maxAverageNum, generations_));
                 }
             }
 
 
-            void put(Key key, Value value)
+            void put(Key key, Value value, CacheTag tag = kNoTag)
             {
 
                 size_t sliceIndex = Hash(key) % sliceNum_;
-                lfuSliceCaches_[sliceIndex]->put(key, value);
+                lfuSliceCaches_[sliceIndex]->put(key, value, tag);
             }
 
             bool get(Key key, Value& value)
@@ -286,14 +558,47 @@ namespace Cache{
                 return value;
             }
 
-            void purge()
+            bool remove(Key key)
+            {
+                size_t sliceIndex = Hash(key) % sliceNum_;
+                return lfuSliceCaches_[sliceIndex]->remove(key);
+            }
+
+            // partitions the range by slice, then loads every slice in parallel
+            template<typename ForwardIt> void bulkLoad(ForwardIt first, ForwardIt last)
+            {
+                bulkLoad(first, last, [](const Key&, const Value&) {return 1;});
+            }
+
+            template<typename ForwardIt, typename FreqFn> void bulkLoad(ForwardIt first, ForwardIt last, FreqFn initialFreq)
+            {
+                auto parts = partitionBySlice(first, last, sliceNum_, [this](const Key& key) {return Hash(key) % sliceNum_;});
+                forEachSliceParallel(sliceNum_, [&](size_t sliceIndex)
+                {
+                    const auto& part = parts[sliceIndex];
+                    lfuSliceCaches_[sliceIndex]->bulkLoad(IndirectIterator<ForwardIt>(part.begin()), IndirectIterator<ForwardIt>(part.end()), initialFreq);
+                });
+            }
+
+            void setRemovalListener(Listener listener)
             {
                 for (auto& lfuSliceCache : lfuSliceCaches_)
                 {
-                    lfuSliceCache->purge();
+                    lfuSliceCache->setRemovalListener(listener);
                 }
             }
 
+            // one counter bump shared by all slices; each slice drops its entries lazily
+            void purge()
+            {
+                generations_->purge();
+            }
+
+            void invalidateTag(CacheTag tag)
+            {
+                generations_->invalidate(tag);
+            }
+
         private:
             size_t Hash(Key key)
             {
@@ -305,5 +610,6 @@ namespace Cache{
             size_t capacity_;
             int sliceNum_;
             std::vector<std::unique_ptr<LfuCache<Key,Value>>> lfuSliceCaches_;
+            std::shared_ptr<GenerationTable> generations_;
     };
 }
\ No newline at end of file
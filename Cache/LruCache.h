@@ -1,19 +1,29 @@
 #pragma once
 
+#include <atomic>
+#include <cmath>
+#include <cstdint>
 #include <cstring>
+#include <iterator>
 #include <list>
 #include <memory>
 #include <mutex>
+#include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 #include<thread>
 
 #include "CachePolicy.h"
+#include "Generation.h"
+#include "SliceParallel.h"
 
 namespace Cache{
 
     template<typename Key, typename Value> class LruCache;
 
-    template<typename Key, typename Value> class LruNode {
+    template<typename Key, typename Value> class LruNode : public TagStamp {
         private:
             Key key_;
             Value value_;
@@ -31,34 +41,66 @@ namespace Cache{
             friend class LruCache<Key, Value>;
     };
 
-    template<typename Key, typename Value> class LruCache : public CachePolicy<Key, Value> {
+    template<typename Key, typename Value> class LruCache : public CachePolicy<Key, Value>, public GenerationTracker {
         public:
             using LruNodeType = LruNode<Key, Value>;
             using NodePtr = std::shared_ptr<LruNodeType>;
             using NodeMap = std::unordered_map<Key, NodePtr>;
-            LruCache(int capacity): capacity_(capacity) {initializeList();}
-            ~LruCache() override = default;
+            using Listener = RemovalListener<Key, Value>;
+
+            LruCache(int capacity, std::shared_ptr<GenerationTable> generations = nullptr)
+            : GenerationTracker(std::move(generations))
+            , capacity_(capacity) {initializeList();}
+
+            ~LruCache() override {
+                releaseChain(dummyHead_);
+            }
 
             void put(Key key, Value value) override {
+                put(key, value, kNoTag);
+            }
+
+            void put(Key key, Value value, CacheTag tag) {
                 if(capacity_ <=0) {return;}
-                std::lock_guard<std::mutex> lock(mutex_);
-                auto it = NodeMap_.find(key);
-                if (it!= NodeMap_.end()) {
-                    updateExistingNode(it->second, value);
-                    return;
+                Removals removed;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    syncGeneration(removed);
+                    auto it = NodeMap_.find(key);
+                    if(it != NodeMap_.end() && isStale(*it->second)) {
+                        dropNode(it, RemovalCause::Expired, removed);
+                        it = NodeMap_.end();
+                    }
+                    if (it!= NodeMap_.end()) {
+                        updateExistingNode(it->second, value, tag, removed);
+                    }
+                    else {
+                        addNewNode(key, value, tag, removed);
+                    }
                 }
-                addNewNode(key, value);
+                notifyRemoved(removed);
             }
 
             bool get(Key key, Value& value) override {
-                std::lock_guard<std::mutex> lock(mutex_);
-                auto it = NodeMap_.find(key);
-                if(it != NodeMap_.end()) {
-                    moveToMostRecent(it->second);
-                    value = it->second->getValue();
-                    return true;
+                Removals removed;
+                bool found = false;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    syncGeneration(removed);
+                    auto it = NodeMap_.find(key);
+                    if(it != NodeMap_.end()) {
+                        if(isStale(*it->second)) {
+                            dropNode(it, RemovalCause::Expired, removed);
+                        }
+                        else {
+                            moveToMostRecent(it->second);
+                            value = it->second->getValue();
+                            found = true;
+                        }
+                    }
                 }
-                return false;
+                notifyRemoved(removed);
+                return found;
             }
 
             Value get(Key key) override {
@@ -67,16 +109,95 @@ namespace Cache{
                 return value;
             }
 
-            void remove(Key key) {
-                std::lock_guard<std::mutex> lock(mutex_);
-                auto it = NodeMap_.find(key);
-                if(it != NodeMap_.end()) {
-                    removeNode(it->second);
-                    NodeMap_.erase(it);
+            bool remove(Key key) {
+                Removals removed;
+                bool found = false;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    syncGeneration(removed);
+                    auto it = NodeMap_.find(key);
+                    if(it != NodeMap_.end()) {
+                        found = !isStale(*it->second);
+                        dropNode(it, found ? RemovalCause::Explicit : RemovalCause::Expired, removed);
+                    }
+                }
+                notifyRemoved(removed);
+                return found;
+            }
+
+            void setRemovalListener(Listener listener) {
+                listener_ = std::move(listener);
+            }
+
+            // loads a range of (key, value) pairs under one lock, ending in the same state
+            // as putting them in order: the last one is most recent. Entries that would
+            // be evicted again before the end of the range are never allocated
+            template<typename BidirIt> void bulkLoad(BidirIt first, BidirIt last) {
+                if(capacity_ <= 0) {return;}
+                Removals removed;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    syncGeneration(removed);
+                    first = skipSurplus(first, last, removed);
+                    size_t incoming = static_cast<size_t>(std::distance(first, last));
+                    NodeMap_.reserve(std::min(static_cast<size_t>(capacity_), NodeMap_.size() + incoming));
+                    for(; first != last; ++first) {
+                        const auto& entry = *first;
+                        auto it = NodeMap_.find(entry.first);
+                        if(it != NodeMap_.end() && isStale(*it->second)) {
+                            dropNode(it, RemovalCause::Expired, removed);
+                            it = NodeMap_.end();
+                        }
+                        if(it != NodeMap_.end()) {
+                            updateExistingNode(it->second, entry.second, kNoTag, removed);
+                        }
+                        else {
+                            addNewNode(entry.first, entry.second, kNoTag, removed);
+                        }
+                    }
                 }
+                notifyRemoved(removed);
             }
 
             private:
+                struct Removals {
+                    RemovalBatch<NodePtr> nodes;
+                    RemovalList<std::pair<Key, Value>> replaced;    // old values of overwritten entries
+                    NodeMap purged;         // whole slice dropped after a purge
+                    NodePtr purgedHead;     // its list, unlinked iteratively
+                };
+
+                // start of the shortest suffix holding capacity distinct keys, found walking
+                // backwards; only those keys survive a put of every entry in order. A cached
+                // key that appears only before it is dropped rather than kept with its old value
+                template<typename BidirIt> BidirIt skipSurplus(BidirIt first, BidirIt last, Removals& removed) {
+                    size_t capacity = static_cast<size_t>(capacity_);
+                    if(static_cast<size_t>(std::distance(first, last)) <= capacity) {
+                        return first;
+                    }
+                    std::unordered_set<Key> survivors;
+                    survivors.reserve(capacity);
+                    BidirIt start = last;
+                    while(start != first) {
+                        BidirIt prev = std::prev(start);
+                        if(survivors.size() == capacity && !survivors.count(prev->first)) {
+                            break;
+                        }
+                        survivors.insert(prev->first);
+                        start = prev;
+                    }
+                    for(; first != start; ++first) {
+                        if(survivors.count(first->first)) {
+                            continue;
+                        }
+                        auto it = NodeMap_.find(first->first);
+                        if(it != NodeMap_.end()) {
+                            dropNode(it, isStale(*it->second) ? RemovalCause::Expired : RemovalCause::Size, removed);
+                        }
+                    }
+                    return start;
+                }
+
                 void initializeList() {
                     dummyHead_ = std::make_shared<LruNodeType>(Key(), Value());
                     dummyTail_ = std::make_shared<LruNodeType>(Key(), Value());
@@ -84,17 +205,47 @@ namespace Cache{
                     dummyTail_->prev_ = dummyHead_;
                 }
 
-                void updateExistingNode(NodePtr node, const Value& value) {
+                // letting a next_ chain destroy itself recurses once per node
+                static void releaseChain(NodePtr node) {
+                    while(node) {
+                        NodePtr next = std::move(node->next_);
+                        node = std::move(next);
+                    }
+                }
+
+                // a purge since our last operation: hand the whole slice to the batch in O(1)
+                void syncGeneration(Removals& removed) {
+                    if(!catchUpGeneration() || NodeMap_.empty()) {
+                        return;
+                    }
+                    removed.purged.swap(NodeMap_);
+                    removed.purgedHead = dummyHead_;
+                    initializeList();
+                }
+
+                void dropNode(typename NodeMap::iterator it, RemovalCause cause, Removals& removed) {
+                    removeNode(it->second);
+                    removed.nodes.emplace_back(it->second, cause);
+                    NodeMap_.erase(it);
+                }
+
+                void updateExistingNode(NodePtr node, const Value& value, CacheTag tag, Removals& removed) {
+                    if(listener_ || !std::is_trivially_destructible<Value>::value) {
+                        // move the old value out so it is destroyed after unlock
+                        removed.replaced.emplace_back(node->key_, std::move(node->value_));
+                    }
                     node->setValue(value);
+                    stamp(*node, tag);
                     moveToMostRecent(node);
                 }
 
-                void addNewNode(const Key&key, const Value& value) {
+                void addNewNode(const Key&key, const Value& value, CacheTag tag, Removals& removed) {
                     if(NodeMap_.size()>=capacity_) {
-                        evictLeastRecent();
+                        evictLeastRecent(removed);
                     }
 
                     NodePtr newNode = std::make_shared<LruNodeType>(key, value);
+                    stamp(*newNode, tag);
                     insertNode(newNode);
                     NodeMap_[key] = newNode;
                 }
@@ -120,16 +271,41 @@ namespace Cache{
                     dummyTail_->prev_ = node;
                 }
 
-                void evictLeastRecent() {
+                // invalidated entries are never touched again, so they drift to the head
+                // and are reclaimed here like any other cold entry
+                void evictLeastRecent(Removals& removed) {
                     NodePtr leastRecent = dummyHead_->next_;
                     removeNode(leastRecent);
                     NodeMap_.erase(leastRecent->getKey());
+                    removed.nodes.emplace_back(leastRecent, isStale(*leastRecent) ? RemovalCause::Expired : RemovalCause::Size);
+                }
+
+                // runs after the lock is released; the batch holds the last references
+                void notifyRemoved(Removals& removed) {
+                    if(listener_) {
+                        for(const auto& entry : removed.nodes) {
+                            listener_(entry.first->key_, entry.first->value_, entry.second);
+                        }
+                        for(const auto& entry : removed.replaced) {
+                            listener_(entry.first, entry.second, RemovalCause::Replaced);
+                        }
+                        if(removed.purgedHead) {
+                            for(NodePtr node = removed.purgedHead->next_; node && node->next_; node = node->next_) {
+                                listener_(node->key_, node->value_, RemovalCause::Expired);
+                            }
+                        }
+                    }
+                    removed.nodes.clear();
+                    removed.replaced.clear();
+                    releaseChain(std::move(removed.purgedHead));
+                    removed.purged.clear();
                 }
 
             private:
                 int capacity_;
                 NodeMap NodeMap_;
                 std::mutex mutex_;
+                Listener listener_;
                 NodePtr dummyHead_;
                 NodePtr dummyTail_;
     };
@@ -183,6 +359,13 @@ namespace Cache{
                 }
             }
 
+            // pending history values would otherwise be promoted after the purge
+            void purge() {
+                LruCache<Key, Value>::purge();
+                historyList_->purge();
+                historyValueMap_.clear();
+            }
+
         private:
             int k_;
             std::unique_ptr<LruCache<Key, size_t>> historyList_;
@@ -191,23 +374,102 @@ namespace Cache{
 
     template<typename Key, typename Value> class HashLruCaches {
         public:
-            HashLruCaches(size_t capacity, int sliceNum)
+            using Listener = RemovalListener<Key, Value>;
+
+            // nearCache: serve repeat reads from a small per-thread table that is
+            // validated against a per-slice epoch instead of locking the slice
+            HashLruCaches(size_t capacity, int sliceNum, bool nearCache = false)
             : capacity_(capacity)
-            , sliceNum_(sliceNum > 0 ? sliceNum : std::thread::hardware_concurrency()){
+            , sliceNum_(sliceNum > 0 ? sliceNum : std::thread::hardware_concurrency())
+            , nearCache_(nearCache)
+            , instanceId_(nextInstanceId())
+            , sliceEpochs_(new SliceEpoch[sliceNum_])
+            , generations_(std::make_shared<GenerationTable>()){
                 size_t sliceSize = std::ceil(capacity / static_cast<double>(sliceNum_));
                 for(int i = 0; i < sliceNum_; i++) {
-                    lruSliceCaches_.emplace_back(new LruCache<Key, Value>(sliceSize));
+                    lruSliceCaches_.emplace_back(new LruCache<Key, Value>(sliceSize, generations_));
+                }
+            }
+
+            // only this thread's table is reachable here; see nearTable() for the others
+            ~HashLruCaches() {
+                if(nearCache_) {
+                    for(NearEntry& entry : nearTable()) {
+                        if(entry.owner == instanceId_) {
+                            entry = NearEntry{};
+                        }
+                    }
                 }
             }
         
-            void put(Key key, Value value) {
+            void put(Key key, Value value, CacheTag tag = kNoTag) {
                 size_t sliceIndex = Hash(key)% sliceNum_;
-                lruSliceCaches_[sliceIndex]->put(key, value);
+                lruSliceCaches_[sliceIndex]->put(key, value, tag);
+                bumpEpoch(sliceIndex);
             }
 
             bool get(Key key, Value& value) {
+                size_t hash = Hash(key);
+                size_t sliceIndex = hash % sliceNum_;
+                if(!nearCache_) {
+                    return lruSliceCaches_[sliceIndex]->get(key, value);
+                }
+
+                // epoch is read before the slice so a concurrent write always
+                // leaves the entry tagged with an epoch that is already stale
+                uint64_t epoch = sliceEpochs_[sliceIndex].value.load(std::memory_order_acquire);
+                NearEntry& entry = nearTable()[hash % kNearCacheSlots];
+                if(entry.owner == instanceId_ && entry.epoch == epoch && entry.key == key) {
+                    value = entry.value;
+                    return true;
+                }
+                if(!lruSliceCaches_[sliceIndex]->get(key, value)) {
+                    // don't keep a removed or purged value alive in the slot
+                    entry = NearEntry{};
+                    return false;
+                }
+                entry.owner = instanceId_;
+                entry.epoch = epoch;
+                entry.key = key;
+                entry.value = value;
+                return true;
+            }
+
+            bool remove(Key key) {
                 size_t sliceIndex = Hash(key)% sliceNum_;
-                return lruSliceCaches_[sliceIndex]->get(key, value);
+                bool found = lruSliceCaches_[sliceIndex]->remove(key);
+                bumpEpoch(sliceIndex);
+                return found;
+            }
+
+            // one counter bump shared by all slices; near-cache entries are
+            // dropped by bumping every slice epoch as well
+            void purge() {
+                generations_->purge();
+                bumpAllEpochs();
+            }
+
+            void invalidateTag(CacheTag tag) {
+                generations_->invalidate(tag);
+                bumpAllEpochs();
+            }
+
+            // partitions the range by slice, then loads every slice in parallel; each
+            // slice skips what it could not keep, so surplus entries are never copied.
+            // A forward range is enough: the slices walk the partition, not the range
+            template<typename ForwardIt> void bulkLoad(ForwardIt first, ForwardIt last) {
+                auto parts = partitionBySlice(first, last, sliceNum_, [this](const Key& key) {return Hash(key) % sliceNum_;});
+                forEachSliceParallel(sliceNum_, [&](size_t sliceIndex) {
+                    const auto& part = parts[sliceIndex];
+                    lruSliceCaches_[sliceIndex]->bulkLoad(IndirectIterator<ForwardIt>(part.begin()), IndirectIterator<ForwardIt>(part.end()));
+                    bumpEpoch(sliceIndex);
+                });
+            }
+
+            void setRemovalListener(Listener listener) {
+                for(auto& lruSliceCache : lruSliceCaches_) {
+                    lruSliceCache->setRemovalListener(listener);
+                }
             }
 
             Value get(Key key) {
@@ -217,9 +479,62 @@ namespace Cache{
                 return value;
             }
 
+        private:
+            static const size_t kNearCacheSlots = 1024;
+
+            // one cache line per counter so writers on different slices don't collide
+            struct alignas(64) SliceEpoch {
+                std::atomic<uint64_t> value{0};
+            };
+
+            struct NearEntry {
+                uint64_t owner = 0;   // instanceId_ of the cache that filled it, 0 = empty
+                uint64_t epoch = 0;
+                Key key{};
+                Value value{};
+            };
+
+            // direct-mapped and shared by every HashLruCaches<Key, Value> on this thread;
+            // entries are only trusted when owner and slice epoch both match. Every
+            // write to a slice (put, remove, bulkLoad, purge, invalidateTag) bumps its
+            // epoch, so it invalidates every thread's near entries for that slice.
+            // A slot's copy is released by the next lookup that misses through it, so
+            // each thread keeps at most kNearCacheSlots removed/evicted values alive;
+            // keep values cheap to hold (or behind a pointer) when using the near cache
+            static std::vector<NearEntry>& nearTable() {
+                static thread_local std::vector<NearEntry> table(kNearCacheSlots);
+                return table;
+            }
+
+            static uint64_t nextInstanceId() {
+                static std::atomic<uint64_t> counter{0};
+                return ++counter;
+            }
+
+            void bumpEpoch(size_t sliceIndex) {
+                if(nearCache_) {
+                    sliceEpochs_[sliceIndex].value.fetch_add(1, std::memory_order_release);
+                }
+            }
+
+            void bumpAllEpochs() {
+                for(int i = 0; i < sliceNum_; i++) {
+                    bumpEpoch(i);
+                }
+            }
+
+            size_t Hash(Key key) {
+                std::hash<Key> hashFunc;
+                return hashFunc(key);
+            }
+
         private:
             size_t capacity_;
             int sliceNum_;
+            bool nearCache_;
+            uint64_t instanceId_;
+            std::unique_ptr<SliceEpoch[]> sliceEpochs_;
+            std::shared_ptr<GenerationTable> generations_;
             std::vector<std::unique_ptr<LruCache<Key,Value>>> lruSliceCaches_;
     };
 }
\ No newline at end of file
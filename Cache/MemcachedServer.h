@@ -0,0 +1,618 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "LfuCache.h"
+#include "LruCache.h"
+
+namespace Cache{
+
+    // what the server stores per key; shared so a get hands out a reference
+    // that writev can send straight from, without copying the data
+    struct CacheItem {
+        std::string data;
+        uint32_t flags;
+        uint64_t cas;
+    };
+
+    using CacheItemPtr = std::shared_ptr<const CacheItem>;
+
+    class ItemStore {
+        public:
+            virtual ~ItemStore() = default;
+            virtual void put(const std::string& key, CacheItemPtr item) = 0;
+            virtual bool get(const std::string& key, CacheItemPtr& item) = 0;
+            virtual bool remove(const std::string& key) = 0;
+            virtual void purge() = 0;
+    };
+
+    // adapts HashLruCaches / HashLfuCache to the server
+    template<typename ShardedCache> class ShardedItemStore : public ItemStore {
+        public:
+            template<typename... Args>
+            explicit ShardedItemStore(Args&&... args): cache_(std::forward<Args>(args)...) {}
+
+            void put(const std::string& key, CacheItemPtr item) override {cache_.put(key, std::move(item));}
+            bool get(const std::string& key, CacheItemPtr& item) override {return cache_.get(key, item);}
+            bool remove(const std::string& key) override {return cache_.remove(key);}
+            void purge() override {cache_.purge();}
+
+        private:
+            ShardedCache cache_;
+    };
+
+    struct ServerOptions {
+        int port = 11211;           // 0 disables tcp
+        std::string unixPath;       // empty disables the unix socket
+        int threads = 0;            // 0 = hardware_concurrency
+        size_t maxValueSize = 1024 * 1024;
+    };
+
+    // memcached text protocol (get/gets/set/delete/flush_all/version/quit) over tcp and unix
+    // sockets. Every worker owns an epoll loop and its own SO_REUSEPORT tcp listener,
+    // so the kernel spreads connections and a connection never changes thread.
+    // exptime is accepted but ignored: the caches behind the store have no ttl
+    class MemcachedServer {
+        public:
+            MemcachedServer(ItemStore& store, ServerOptions options)
+            : store_(store)
+            , options_(std::move(options))
+            , unixFd_(-1)
+            , running_(false)
+            , nextCas_(0){
+                if(options_.threads <= 0) {
+                    options_.threads = std::max(1u, std::thread::hardware_concurrency());
+                }
+            }
+
+            ~MemcachedServer() {
+                stop();
+                wait();
+                if(unixFd_ >= 0) {
+                    close(unixFd_);
+                    unlink(options_.unixPath.c_str());
+                }
+            }
+
+            // binds every listener up front so failures are reported before threads start
+            bool start() {
+                if(options_.port <= 0 && options_.unixPath.empty()) {
+                    std::fprintf(stderr, "no listener configured\n");
+                    return false;
+                }
+                std::vector<int> tcpFds;
+                for(int i = 0; i < options_.threads && options_.port > 0; i++) {
+                    int fd = openTcpListener(options_.port);
+                    if(fd < 0) {
+                        for(int opened : tcpFds) {
+                            close(opened);
+                        }
+                        return false;
+                    }
+                    tcpFds.push_back(fd);
+                }
+                if(!options_.unixPath.empty()) {
+                    unixFd_ = openUnixListener(options_.unixPath);
+                    if(unixFd_ < 0) {
+                        for(int opened : tcpFds) {
+                            close(opened);
+                        }
+                        return false;
+                    }
+                }
+
+                running_ = true;
+                for(int i = 0; i < options_.threads; i++) {
+                    int tcpFd = tcpFds.empty() ? -1 : tcpFds[i];
+                    workers_.emplace_back(&MemcachedServer::workerLoop, this, tcpFd);
+                }
+                return true;
+            }
+
+            void stop() {running_ = false;}
+
+            void wait() {
+                for(auto& worker : workers_) {
+                    if(worker.joinable()) {
+                        worker.join();
+                    }
+                }
+                workers_.clear();
+            }
+
+        private:
+            static const size_t kMaxKeyLength = 250;
+            static const size_t kReadChunk = 16 * 1024;
+            static const size_t kMaxReadPerEvent = 256 * 1024;        // then other connections get a turn
+            static const size_t kMaxLineLength = 64 * 1024;
+            static const size_t kMaxPendingOutput = 4 * 1024 * 1024;  // stop reading above this
+            static const int kMaxIov = 64;
+
+            // one piece of pending output: either owned text or a cached item's data
+            struct OutChunk {
+                std::string text;
+                CacheItemPtr item;
+                size_t offset = 0;
+
+                const char* data() const {return item ? item->data.data() : text.data();}
+                size_t size() const {return item ? item->data.size() : text.size();}
+            };
+
+            struct Connection {
+                int fd;
+                std::string in;
+                size_t inOffset = 0;
+                std::deque<OutChunk> out;
+                size_t pendingOut = 0;
+                size_t swallow = 0;     // bytes of an oversized value still to discard
+                bool discardLine = false;   // rest of a bad data chunk, dropped up to the next newline
+                uint32_t interest = EPOLLIN;
+                bool closing = false;
+                std::vector<std::pair<const char*, size_t>> tokens;  // reused across requests
+
+                explicit Connection(int f): fd(f) {}
+
+                void appendText(const char* text, size_t len) {
+                    // small responses are coalesced into one owned chunk
+                    if(out.empty() || out.back().item) {
+                        out.emplace_back();
+                    }
+                    out.back().text.append(text, len);
+                    pendingOut += len;
+                }
+
+                void appendText(const std::string& text) {appendText(text.data(), text.size());}
+
+                void appendItem(CacheItemPtr item) {
+                    pendingOut += item->data.size();
+                    out.emplace_back();
+                    out.back().item = std::move(item);
+                }
+            };
+
+            static bool setNonBlocking(int fd) {
+                int flags = fcntl(fd, F_GETFL, 0);
+                return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+            }
+
+            static int openTcpListener(int port) {
+                int fd = socket(AF_INET6, SOCK_STREAM, 0);
+                if(fd < 0) {
+                    std::perror("socket");
+                    return -1;
+                }
+                int on = 1;
+                int off = 0;
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+                setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+                setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+
+                sockaddr_in6 addr{};
+                addr.sin6_family = AF_INET6;
+                addr.sin6_addr = in6addr_any;
+                addr.sin6_port = htons(static_cast<uint16_t>(port));
+                if(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0 || !setNonBlocking(fd)) {
+                    std::perror("tcp listen");
+                    close(fd);
+                    return -1;
+                }
+                return fd;
+            }
+
+            static int openUnixListener(const std::string& path) {
+                sockaddr_un addr{};
+                if(path.size() >= sizeof(addr.sun_path)) {
+                    std::fprintf(stderr, "unix socket path too long: %s\n", path.c_str());
+                    return -1;
+                }
+                int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+                if(fd < 0) {
+                    std::perror("socket");
+                    return -1;
+                }
+                addr.sun_family = AF_UNIX;
+                std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+                unlink(path.c_str());
+                if(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0 || !setNonBlocking(fd)) {
+                    std::perror("unix listen");
+                    close(fd);
+                    return -1;
+                }
+                return fd;
+            }
+
+            void workerLoop(int tcpFd) {
+                int epfd = epoll_create1(0);
+                if(epfd < 0) {
+                    std::perror("epoll_create1");
+                    return;
+                }
+                std::unordered_map<int, std::unique_ptr<Connection>> connections;
+
+                epoll_event ev{};
+                if(tcpFd >= 0) {
+                    ev.events = EPOLLIN;
+                    ev.data.fd = tcpFd;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, tcpFd, &ev);
+                }
+                if(unixFd_ >= 0) {
+                    // shared by all workers; EPOLLEXCLUSIVE wakes only one of them
+                    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+                    ev.data.fd = unixFd_;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, unixFd_, &ev);
+                }
+
+                std::vector<epoll_event> events(256);
+                while(running_) {
+                    int n = epoll_wait(epfd, events.data(), static_cast<int>(events.size()), 200);
+                    if(n < 0 && errno != EINTR) {
+                        std::perror("epoll_wait");
+                        break;
+                    }
+                    for(int i = 0; i < n; i++) {
+                        int fd = events[i].data.fd;
+                        if(fd == tcpFd || fd == unixFd_) {
+                            acceptAll(epfd, fd, fd == tcpFd, connections);
+                            continue;
+                        }
+                        auto it = connections.find(fd);
+                        if(it == connections.end()) {
+                            continue;
+                        }
+                        Connection& conn = *it->second;
+                        if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+                            conn.closing = true;
+                        }
+                        if(!conn.closing && (events[i].events & EPOLLOUT)) {
+                            flush(conn);
+                        }
+                        if(!conn.closing && (events[i].events & EPOLLIN)) {
+                            readAndProcess(conn);
+                            flush(conn);
+                        }
+                        if(conn.closing) {
+                            close(fd);
+                            connections.erase(it);
+                            continue;
+                        }
+                        updateInterest(epfd, conn);
+                    }
+                }
+
+                for(auto& entry : connections) {
+                    close(entry.first);
+                }
+                if(tcpFd >= 0) {
+                    close(tcpFd);
+                }
+                close(epfd);
+            }
+
+            void acceptAll(int epfd, int listenFd, bool tcp, std::unordered_map<int, std::unique_ptr<Connection>>& connections) {
+                while(true) {
+                    int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK);
+                    if(fd < 0) {
+                        return;  // EAGAIN, or another worker won the unix accept
+                    }
+                    if(tcp) {
+                        int on = 1;
+                        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                    }
+                    epoll_event ev{};
+                    ev.events = EPOLLIN;
+                    ev.data.fd = fd;
+                    if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                        close(fd);
+                        continue;
+                    }
+                    connections[fd].reset(new Connection(fd));
+                }
+            }
+
+            void updateInterest(int epfd, Connection& conn) {
+                uint32_t interest = EPOLLIN;
+                if(conn.pendingOut > 0) {
+                    // while output is backed up, stop reading so a pipelining client can't grow it unbounded
+                    interest = conn.pendingOut > kMaxPendingOutput ? EPOLLOUT : EPOLLIN | EPOLLOUT;
+                }
+                if(interest == conn.interest) {
+                    return;
+                }
+                conn.interest = interest;
+                epoll_event ev{};
+                ev.events = interest;
+                ev.data.fd = conn.fd;
+                epoll_ctl(epfd, EPOLL_CTL_MOD, conn.fd, &ev);
+            }
+
+            // every chunk is parsed as soon as it is read, so the input buffer only holds
+            // one unfinished request. Reading stops at kMaxReadPerEvent or once output
+            // backs up; epoll is level triggered and comes back for the rest
+            void readAndProcess(Connection& conn) {
+                char buffer[kReadChunk];
+                size_t budget = kMaxReadPerEvent;
+                while(!conn.closing && budget > 0 && conn.pendingOut <= kMaxPendingOutput) {
+                    ssize_t got = read(conn.fd, buffer, sizeof(buffer));
+                    if(got > 0) {
+                        conn.in.append(buffer, static_cast<size_t>(got));
+                        processInput(conn);
+                        budget -= std::min(budget, static_cast<size_t>(got));
+                        if(static_cast<size_t>(got) < sizeof(buffer)) {
+                            break;
+                        }
+                        continue;
+                    }
+                    if(got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                        conn.closing = true;
+                    }
+                    break;
+                }
+            }
+
+            // answers every complete request in the buffer; the replies go out with one writev
+            void processInput(Connection& conn) {
+                while(!conn.closing && processOne(conn)) {}
+                if(conn.inOffset > 0) {
+                    conn.in.erase(0, conn.inOffset);
+                    conn.inOffset = 0;
+                }
+            }
+
+            // whole chunks go out with one writev; partially sent chunks keep their offset
+            void flush(Connection& conn) {
+                while(conn.pendingOut > 0) {
+                    iovec iov[kMaxIov];
+                    int count = 0;
+                    for(auto it = conn.out.begin(); it != conn.out.end() && count < kMaxIov; ++it) {
+                        iov[count].iov_base = const_cast<char*>(it->data() + it->offset);
+                        iov[count].iov_len = it->size() - it->offset;
+                        count++;
+                    }
+                    ssize_t sent = writev(conn.fd, iov, count);
+                    if(sent < 0) {
+                        if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                            conn.closing = true;
+                        }
+                        return;
+                    }
+                    size_t left = static_cast<size_t>(sent);
+                    conn.pendingOut -= left;
+                    while(left > 0) {
+                        OutChunk& front = conn.out.front();
+                        size_t remain = front.size() - front.offset;
+                        if(left < remain) {
+                            front.offset += left;
+                            break;
+                        }
+                        left -= remain;
+                        conn.out.pop_front();
+                    }
+                }
+            }
+
+            // handles the request at the front of the input buffer; false when it is incomplete
+            bool processOne(Connection& conn) {
+                if(conn.swallow > 0) {
+                    size_t available = conn.in.size() - conn.inOffset;
+                    size_t skip = std::min(available, conn.swallow);
+                    conn.inOffset += skip;
+                    conn.swallow -= skip;
+                    return conn.swallow == 0;
+                }
+
+                const char* begin = conn.in.data() + conn.inOffset;
+                size_t available = conn.in.size() - conn.inOffset;
+                const char* newline = static_cast<const char*>(std::memchr(begin, '\n', available));
+                if(conn.discardLine) {
+                    conn.inOffset += newline ? newline - begin + 1 : available;
+                    conn.discardLine = !newline;
+                    return newline != nullptr;
+                }
+                if(!newline) {
+                    if(available > kMaxLineLength) {
+                        conn.appendText("CLIENT_ERROR line too long\r\n");
+                        conn.closing = true;
+                    }
+                    return false;
+                }
+                size_t lineLength = newline - begin;
+                size_t consumed = lineLength + 1;
+                if(lineLength > 0 && begin[lineLength - 1] == '\r') {
+                    lineLength--;
+                }
+
+                std::vector<std::pair<const char*, size_t>>& tokens = conn.tokens;
+                tokens.clear();
+                tokenize(begin, lineLength, tokens);
+                if(tokens.empty()) {
+                    conn.inOffset += consumed;
+                    conn.appendText("ERROR\r\n");
+                    return true;
+                }
+
+                const std::string command(tokens[0].first, tokens[0].second);
+                if(command == "get" || command == "gets") {
+                    conn.inOffset += consumed;
+                    handleGet(conn, tokens, command == "gets");
+                    return true;
+                }
+                if(command == "set") {
+                    return handleSet(conn, tokens, consumed);
+                }
+                conn.inOffset += consumed;
+                if(command == "delete") {
+                    handleDelete(conn, tokens);
+                }
+                else if(command == "flush_all") {
+                    // O(1) generation bump; a delay argument is accepted but not honoured
+                    store_.purge();
+                    bool noreply = tokens.size() > 1 && std::string(tokens.back().first, tokens.back().second) == "noreply";
+                    if(!noreply) {
+                        conn.appendText("OK\r\n", 4);
+                    }
+                }
+                else if(command == "version") {
+                    conn.appendText("VERSION 1.6.0-cache-system\r\n");
+                }
+                else if(command == "quit") {
+                    conn.closing = true;
+                }
+                else {
+                    conn.appendText("ERROR\r\n");
+                }
+                return true;
+            }
+
+            static void tokenize(const char* line, size_t length, std::vector<std::pair<const char*, size_t>>& tokens) {
+                size_t i = 0;
+                while(i < length) {
+                    while(i < length && line[i] == ' ') {
+                        i++;
+                    }
+                    size_t start = i;
+                    while(i < length && line[i] != ' ') {
+                        i++;
+                    }
+                    if(i > start) {
+                        tokens.emplace_back(line + start, i - start);
+                    }
+                }
+            }
+
+            static bool parseNumber(const std::pair<const char*, size_t>& token, uint64_t& out) {
+                if(token.second == 0 || token.second > 20) {
+                    return false;
+                }
+                uint64_t value = 0;
+                for(size_t i = 0; i < token.second; i++) {
+                    char c = token.first[i];
+                    if(c < '0' || c > '9') {
+                        return false;
+                    }
+                    uint64_t digit = static_cast<uint64_t>(c - '0');
+                    if(value > (UINT64_MAX - digit) / 10) {
+                        return false;  // would wrap
+                    }
+                    value = value * 10 + digit;
+                }
+                out = value;
+                return true;
+            }
+
+            void handleGet(Connection& conn, const std::vector<std::pair<const char*, size_t>>& tokens, bool withCas) {
+                if(tokens.size() < 2) {
+                    conn.appendText("ERROR\r\n");
+                    return;
+                }
+                // reject before any VALUE is sent, the reply would otherwise lack its END
+                for(size_t i = 1; i < tokens.size(); i++) {
+                    if(tokens[i].second > kMaxKeyLength) {
+                        conn.appendText("CLIENT_ERROR bad command line format\r\n");
+                        return;
+                    }
+                }
+                char header[kMaxKeyLength + 96];
+                for(size_t i = 1; i < tokens.size(); i++) {
+                    std::string key(tokens[i].first, tokens[i].second);
+                    CacheItemPtr item;
+                    if(!store_.get(key, item) || !item) {
+                        continue;
+                    }
+                    int len = withCas
+                        ? std::snprintf(header, sizeof(header), "VALUE %s %u %zu %llu\r\n", key.c_str(), item->flags, item->data.size(), static_cast<unsigned long long>(item->cas))
+                        : std::snprintf(header, sizeof(header), "VALUE %s %u %zu\r\n", key.c_str(), item->flags, item->data.size());
+                    conn.appendText(header, static_cast<size_t>(len));
+                    conn.appendItem(std::move(item));
+                    conn.appendText("\r\n", 2);
+                }
+                conn.appendText("END\r\n", 5);
+            }
+
+            // set <key> <flags> <exptime> <bytes> [noreply]
+            bool handleSet(Connection& conn, const std::vector<std::pair<const char*, size_t>>& tokens, size_t lineConsumed) {
+                uint64_t flags = 0;
+                uint64_t exptime = 0;
+                uint64_t bytes = 0;
+                if(tokens.size() < 5 || tokens.size() > 6 || tokens[1].second > kMaxKeyLength
+                    || !parseNumber(tokens[2], flags) || flags > UINT32_MAX
+                    || !parseNumber(tokens[3], exptime) || !parseNumber(tokens[4], bytes) || bytes > INT32_MAX) {
+                    conn.inOffset += lineConsumed;
+                    conn.appendText("CLIENT_ERROR bad command line format\r\n");
+                    return true;
+                }
+                bool noreply = tokens.size() == 6 && std::string(tokens[5].first, tokens[5].second) == "noreply";
+                if(bytes > options_.maxValueSize) {
+                    conn.inOffset += lineConsumed;
+                    conn.swallow = bytes + 2;
+                    conn.appendText("SERVER_ERROR object too large for cache\r\n");
+                    return true;
+                }
+                size_t available = conn.in.size() - conn.inOffset;
+                if(available < lineConsumed + bytes + 2) {
+                    return false;  // wait for the rest of the data block
+                }
+
+                const char* data = conn.in.data() + conn.inOffset + lineConsumed;
+                std::string key(tokens[1].first, tokens[1].second);
+                if(data[bytes] != '\r' || data[bytes + 1] != '\n') {
+                    // like memcached, drop what follows the block up to the next newline
+                    conn.inOffset += lineConsumed + bytes;
+                    conn.discardLine = true;
+                    conn.appendText("CLIENT_ERROR bad data chunk\r\n");
+                    return true;
+                }
+                conn.inOffset += lineConsumed + bytes + 2;
+
+                std::shared_ptr<CacheItem> item = std::make_shared<CacheItem>();
+                item->data.assign(data, bytes);
+                item->flags = static_cast<uint32_t>(flags);
+                item->cas = ++nextCas_;
+                store_.put(key, std::move(item));
+                if(!noreply) {
+                    conn.appendText("STORED\r\n", 8);
+                }
+                return true;
+            }
+
+            void handleDelete(Connection& conn, const std::vector<std::pair<const char*, size_t>>& tokens) {
+                if(tokens.size() < 2 || tokens.size() > 3 || tokens[1].second > kMaxKeyLength) {
+                    conn.appendText("CLIENT_ERROR bad command line format\r\n");
+                    return;
+                }
+                bool noreply = tokens.size() == 3 && std::string(tokens[2].first, tokens[2].second) == "noreply";
+                bool found = store_.remove(std::string(tokens[1].first, tokens[1].second));
+                if(!noreply) {
+                    conn.appendText(found ? "DELETED\r\n" : "NOT_FOUND\r\n");
+                }
+            }
+
+        private:
+            ItemStore& store_;
+            ServerOptions options_;
+            int unixFd_;
+            std::atomic<bool> running_;
+            std::atomic<uint64_t> nextCas_;
+            std::vector<std::thread> workers_;
+    };
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace Cache{
+    // runs fn(sliceIndex) for every slice, spread over up to one thread per core;
+    // used by the sharded caches to build their slices in parallel. The calling
+    // thread takes part too, and the first exception thrown by fn is rethrown
+    // here once every worker has stopped
+    template <typename Fn>
+    void forEachSliceParallel(size_t sliceNum, Fn fn) {
+        size_t threadNum = std::min<size_t>(sliceNum, std::max(1u, std::thread::hardware_concurrency()));
+        if(threadNum <= 1) {
+            for(size_t i = 0; i < sliceNum; i++) {
+                fn(i);
+            }
+            return;
+        }
+        std::atomic<size_t> next(0);
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        auto work = [&]() {
+            try {
+                for(size_t i = next++; i < sliceNum; i = next++) {
+                    fn(i);
+                }
+            }
+            catch(...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if(!error) {
+                    error = std::current_exception();
+                }
+                next = sliceNum;  // the others stop after their current slice
+            }
+        };
+        std::vector<std::thread> workers;
+        for(size_t t = 1; t < threadNum; t++) {
+            try {
+                workers.emplace_back(work);
+            }
+            catch(const std::system_error&) {
+                break;  // fewer threads, the remaining slices still get loaded
+            }
+        }
+        work();
+        for(auto& worker : workers) {
+            worker.join();
+        }
+        if(error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // walks a list of iterators as if it were the entries they point to, so a
+    // slice can bulkLoad its share of the caller's range without copying it.
+    // Bidirectional whatever It is, since the list itself is a vector
+    template <typename It> class IndirectIterator {
+        public:
+            using iterator_category = std::bidirectional_iterator_tag;
+            using value_type = typename std::iterator_traits<It>::value_type;
+            using difference_type = std::ptrdiff_t;
+            using pointer = It;
+            using reference = typename std::iterator_traits<It>::reference;
+
+            explicit IndirectIterator(typename std::vector<It>::const_iterator it): it_(it) {}
+
+            reference operator*() const {return **it_;}
+            pointer operator->() const {return *it_;}
+            IndirectIterator& operator++() {++it_; return *this;}
+            IndirectIterator operator++(int) {IndirectIterator old = *this; ++it_; return old;}
+            IndirectIterator& operator--() {--it_; return *this;}
+            IndirectIterator operator--(int) {IndirectIterator old = *this; --it_; return old;}
+            bool operator==(const IndirectIterator& other) const {return it_ == other.it_;}
+            bool operator!=(const IndirectIterator& other) const {return it_ != other.it_;}
+
+        private:
+            typename std::vector<It>::const_iterator it_;
+    };
+
+    // parts[i] gets iterators to slice i's entries, in input order
+    template <typename ForwardIt, typename SliceOf>
+    std::vector<std::vector<ForwardIt>> partitionBySlice(ForwardIt first, ForwardIt last, size_t sliceNum, SliceOf sliceOf) {
+        std::vector<std::vector<ForwardIt>> parts(sliceNum);
+        for(; first != last; ++first) {
+            parts[sliceOf(first->first)].push_back(first);
+        }
+        return parts;
+    }
+}
@@ -0,0 +1,96 @@
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "MemcachedServer.h"
+
+namespace {
+    volatile std::sig_atomic_t stopRequested = 0;
+
+    void onSignal(int) {
+        stopRequested = 1;
+    }
+
+    void usage(const char* prog) {
+        std::fprintf(stderr,
+            "usage: %s [-p port] [-s unix_path] [-t threads] [-m capacity] [-n slices]\n"
+            "          [--policy lru|lfu] [--near-cache] [--max-value bytes]\n"
+            "  -p 0 disables tcp; capacity is a number of items\n", prog);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Cache::ServerOptions options;
+    size_t capacity = 1000000;
+    int slices = 0;
+    std::string policy = "lru";
+    bool nearCache = false;
+
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(arg == "-p" && hasValue) {
+            options.port = std::atoi(argv[++i]);
+        }
+        else if(arg == "-s" && hasValue) {
+            options.unixPath = argv[++i];
+        }
+        else if(arg == "-t" && hasValue) {
+            options.threads = std::atoi(argv[++i]);
+        }
+        else if(arg == "-m" && hasValue) {
+            capacity = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if(arg == "-n" && hasValue) {
+            slices = std::atoi(argv[++i]);
+        }
+        else if(arg == "--policy" && hasValue) {
+            policy = argv[++i];
+        }
+        else if(arg == "--near-cache") {
+            nearCache = true;
+        }
+        else if(arg == "--max-value" && hasValue) {
+            options.maxValueSize = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::unique_ptr<Cache::ItemStore> store;
+    if(policy == "lru") {
+        store.reset(new Cache::ShardedItemStore<Cache::HashLruCaches<std::string, Cache::CacheItemPtr>>(capacity, slices, nearCache));
+    }
+    else if(policy == "lfu") {
+        store.reset(new Cache::ShardedItemStore<Cache::HashLfuCache<std::string, Cache::CacheItemPtr>>(capacity, slices));
+    }
+    else {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    Cache::MemcachedServer server(*store, options);
+    if(!server.start()) {
+        return 1;
+    }
+    std::printf("cacheServer: policy=%s capacity=%zu port=%d unix=%s\n", policy.c_str(), capacity, options.port, options.unixPath.empty() ? "-" : options.unixPath.c_str());
+    std::fflush(stdout);
+
+    while(!stopRequested) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    server.stop();
+    server.wait();
+    return 0;
+}
@@ -0,0 +1,292 @@
+// load generator for cacheServer: pipelined get/set over tcp or a unix socket,
+// one connection per thread, reports throughput and latency percentiles
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::string host = "127.0.0.1";
+        int port = 11211;
+        std::string unixPath;
+        int connections = 4;
+        int depth = 16;            // requests in flight per connection
+        int seconds = 5;
+        int keys = 100000;
+        int valueSize = 100;
+        int getPercent = 90;
+        bool prefill = true;
+    };
+
+    struct ThreadResult {
+        uint64_t gets = 0;
+        uint64_t hits = 0;
+        uint64_t sets = 0;
+        uint64_t errors = 0;
+        std::vector<uint32_t> latencyUs;
+    };
+
+    int connectTo(const Options& options) {
+        int fd;
+        if(!options.unixPath.empty()) {
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            sockaddr_un addr{};
+            addr.sun_family = AF_UNIX;
+            std::strncpy(addr.sun_path, options.unixPath.c_str(), sizeof(addr.sun_path) - 1);
+            if(fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+                return fd;
+            }
+        }
+        else {
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(static_cast<uint16_t>(options.port));
+            inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr);
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            if(fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+                return fd;
+            }
+        }
+        std::perror("connect");
+        if(fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    bool sendAll(int fd, const std::string& data) {
+        size_t sent = 0;
+        while(sent < data.size()) {
+            ssize_t n = write(fd, data.data() + sent, data.size() - sent);
+            if(n <= 0) {
+                return false;
+            }
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // reads until `expected` responses are complete; isGet says which ones return values.
+    // calls done(index, hit) as each response finishes so latency is per request
+    template<typename Done>
+    bool readResponses(int fd, std::string& buffer, const std::vector<bool>& isGet, Done done) {
+        size_t current = 0;
+        bool hit = false;
+        size_t pos = 0;
+        while(current < isGet.size()) {
+            size_t newline = buffer.find("\r\n", pos);
+            if(newline == std::string::npos) {
+                buffer.erase(0, pos);
+                pos = 0;
+                char chunk[64 * 1024];
+                ssize_t n = read(fd, chunk, sizeof(chunk));
+                if(n <= 0) {
+                    return false;
+                }
+                buffer.append(chunk, static_cast<size_t>(n));
+                continue;
+            }
+            if(isGet[current] && buffer.compare(pos, 6, "VALUE ") == 0) {
+                // VALUE <key> <flags> <bytes>: skip the data block as well
+                size_t lastSpace = buffer.rfind(' ', newline);
+                size_t bytes = std::strtoull(buffer.c_str() + lastSpace + 1, nullptr, 10);
+                size_t end = newline + 2 + bytes + 2;
+                if(buffer.size() < end) {
+                    buffer.erase(0, pos);
+                    pos = 0;
+                    char chunk[64 * 1024];
+                    ssize_t n = read(fd, chunk, sizeof(chunk));
+                    if(n <= 0) {
+                        return false;
+                    }
+                    buffer.append(chunk, static_cast<size_t>(n));
+                    continue;
+                }
+                hit = true;
+                pos = end;
+                continue;
+            }
+            bool ok = isGet[current] ? buffer.compare(pos, newline - pos, "END") == 0
+                                     : buffer.compare(pos, newline - pos, "STORED") == 0;
+            done(current, ok, hit);
+            current++;
+            hit = false;
+            pos = newline + 2;
+        }
+        buffer.erase(0, pos);
+        return true;
+    }
+
+    std::string makeSet(int key, const std::string& value) {
+        return "set key:" + std::to_string(key) + " 0 0 " + std::to_string(value.size()) + "\r\n" + value + "\r\n";
+    }
+
+    std::string makeGet(int key) {
+        return "get key:" + std::to_string(key) + "\r\n";
+    }
+
+    bool prefill(const Options& options) {
+        int fd = connectTo(options);
+        if(fd < 0) {
+            return false;
+        }
+        std::string value(options.valueSize, 'x');
+        std::string buffer;
+        const int batch = 256;
+        for(int start = 0; start < options.keys; start += batch) {
+            int count = std::min(batch, options.keys - start);
+            std::string request;
+            for(int key = start; key < start + count; key++) {
+                request += makeSet(key, value);
+            }
+            std::vector<bool> isGet(count, false);
+            if(!sendAll(fd, request) || !readResponses(fd, buffer, isGet, [](size_t, bool, bool){})) {
+                close(fd);
+                return false;
+            }
+        }
+        close(fd);
+        return true;
+    }
+
+    void runConnection(const Options& options, Clock::time_point deadline, unsigned seed, ThreadResult& result) {
+        int fd = connectTo(options);
+        if(fd < 0) {
+            result.errors++;
+            return;
+        }
+        std::mt19937 gen(seed);
+        std::string value(options.valueSize, 'v');
+        std::string buffer;
+        std::string request;
+        std::vector<bool> isGet(options.depth);
+
+        while(Clock::now() < deadline) {
+            request.clear();
+            for(int i = 0; i < options.depth; i++) {
+                int key = static_cast<int>(gen() % options.keys);
+                isGet[i] = static_cast<int>(gen() % 100) < options.getPercent;
+                request += isGet[i] ? makeGet(key) : makeSet(key, value);
+            }
+            Clock::time_point sentAt = Clock::now();
+            if(!sendAll(fd, request)) {
+                result.errors++;
+                break;
+            }
+            bool ok = readResponses(fd, buffer, isGet, [&](size_t index, bool valid, bool hit) {
+                auto us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - sentAt).count();
+                result.latencyUs.push_back(static_cast<uint32_t>(us));
+                if(!valid) {
+                    result.errors++;
+                }
+                if(isGet[index]) {
+                    result.gets++;
+                    result.hits += hit ? 1 : 0;
+                }
+                else {
+                    result.sets++;
+                }
+            });
+            if(!ok) {
+                result.errors++;
+                break;
+            }
+        }
+        close(fd);
+    }
+
+    void usage(const char* prog) {
+        std::fprintf(stderr,
+            "usage: %s [-h host] [-p port | -s unix_path] [-c connections] [-d depth]\n"
+            "          [-T seconds] [-k keys] [-v value_size] [-r get_percent] [--no-prefill]\n", prog);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(arg == "-h" && hasValue) {options.host = argv[++i];}
+        else if(arg == "-p" && hasValue) {options.port = std::atoi(argv[++i]);}
+        else if(arg == "-s" && hasValue) {options.unixPath = argv[++i];}
+        else if(arg == "-c" && hasValue) {options.connections = std::atoi(argv[++i]);}
+        else if(arg == "-d" && hasValue) {options.depth = std::atoi(argv[++i]);}
+        else if(arg == "-T" && hasValue) {options.seconds = std::atoi(argv[++i]);}
+        else if(arg == "-k" && hasValue) {options.keys = std::atoi(argv[++i]);}
+        else if(arg == "-v" && hasValue) {options.valueSize = std::atoi(argv[++i]);}
+        else if(arg == "-r" && hasValue) {options.getPercent = std::atoi(argv[++i]);}
+        else if(arg == "--no-prefill") {options.prefill = false;}
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(options.connections <= 0 || options.depth <= 0 || options.keys <= 0 || options.seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(options.prefill && !prefill(options)) {
+        std::fprintf(stderr, "prefill failed\n");
+        return 1;
+    }
+
+    std::vector<ThreadResult> results(options.connections);
+    std::vector<std::thread> threads;
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + std::chrono::seconds(options.seconds);
+    for(int i = 0; i < options.connections; i++) {
+        threads.emplace_back(runConnection, std::cref(options), deadline, 1234u + i, std::ref(results[i]));
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    ThreadResult total;
+    for(auto& result : results) {
+        total.gets += result.gets;
+        total.hits += result.hits;
+        total.sets += result.sets;
+        total.errors += result.errors;
+        total.latencyUs.insert(total.latencyUs.end(), result.latencyUs.begin(), result.latencyUs.end());
+    }
+    uint64_t ops = total.gets + total.sets;
+    std::sort(total.latencyUs.begin(), total.latencyUs.end());
+    auto percentile = [&](double p) -> uint32_t {
+        if(total.latencyUs.empty()) {
+            return 0;
+        }
+        size_t index = std::min(total.latencyUs.size() - 1, static_cast<size_t>(p * total.latencyUs.size()));
+        return total.latencyUs[index];
+    };
+
+    std::cout << "--- loadGen result ---" << std::endl;
+    std::cout << "connections: " << options.connections << ", pipeline depth: " << options.depth << ", keys: " << options.keys << ", value size: " << options.valueSize << std::endl;
+    std::cout << std::fixed << std::setprecision(0) << "throughput: " << ops / elapsed << " ops/s" << std::endl;
+    std::cout << std::setprecision(2) << "get hit rate: " << (total.gets ? 100.0 * total.hits / total.gets : 0.0) << "% (" << total.hits << "/" << total.gets << "), sets: " << total.sets << ", errors: " << total.errors << std::endl;
+    std::cout << "latency us p50: " << percentile(0.50) << ", p99: " << percentile(0.99) << ", p99.9: " << percentile(0.999) << ", max: " << percentile(1.0) << std::endl;
+    return total.errors == 0 ? 0 : 2;
+}
@@ -0,0 +1,364 @@
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "CachePolicy.h"
+#include "LruCache.h"
+#include "LfuCache.h"
+#include "ClockCache.h"
+#include "Generation.h"
+#include "SliceParallel.h"
+
+// behaviour checks for the cache features; testPolicy.cpp covers hit rates
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if(!(cond)) { \
+            std::cout << "  FAILED " << __FILE__ << ":" << __LINE__ << ": " #cond << std::endl; \
+            failures++; \
+        } \
+    } while(0)
+
+using Removal = std::tuple<int, std::string, Cache::RemovalCause>;
+
+template<typename CacheType> void recordRemovals(CacheType& cache, std::vector<Removal>& log) {
+    cache.setRemovalListener([&log](const int& key, const std::string& value, Cache::RemovalCause cause) {
+        log.emplace_back(key, value, cause);
+    });
+}
+
+void testRemovalListener() {
+    std::cout << "--- removal listener ---" << std::endl;
+    using Cause = Cache::RemovalCause;
+
+    Cache::LruCache<int, std::string> lru(2);
+    std::vector<Removal> log;
+    recordRemovals(lru, log);
+    lru.put(1, "a");
+    lru.put(2, "b");
+    lru.put(3, "c");                // evicts 1
+    lru.put(2, "b2");               // replaces 2
+    CHECK(lru.remove(3));
+    CHECK(!lru.remove(3));
+    lru.put(4, "d", 7);
+    lru.invalidateTag(7);
+    std::string value;
+    CHECK(!lru.get(4, value));      // dropped as expired
+    std::vector<Removal> expected = {
+        Removal(1, "a", Cause::Size), Removal(2, "b", Cause::Replaced),
+        Removal(3, "c", Cause::Explicit), Removal(4, "d", Cause::Expired)};
+    CHECK(log == expected);
+
+    Cache::LfuCache<int, std::string> lfu(2);
+    log.clear();
+    recordRemovals(lfu, log);
+    lfu.put(1, "a");
+    lfu.put(2, "b");
+    lfu.get(1, value);
+    lfu.put(3, "c");                // evicts 2, the least frequent
+    lfu.put(1, "a2");
+    CHECK(lfu.remove(3));
+    expected = {Removal(2, "b", Cause::Size), Removal(1, "a", Cause::Replaced), Removal(3, "c", Cause::Explicit)};
+    CHECK(log == expected);
+
+    // the first dropped entry is held inline, later ones spill over in order
+    Cache::RemovalList<std::shared_ptr<int>> list;
+    std::vector<std::shared_ptr<int>> dropped = {std::make_shared<int>(1), std::make_shared<int>(2), std::make_shared<int>(3)};
+    for(const auto& entry : dropped) {
+        list.push_back(entry);
+    }
+    std::vector<std::shared_ptr<int>> seen(list.begin(), list.end());
+    CHECK(list.size() == 3 && seen == dropped);
+    seen.clear();
+    list.clear();
+    CHECK(list.size() == 0 && list.begin() == list.end() && dropped[0].use_count() == 1);
+
+    // with no listener the old value is still released once put returns
+    Cache::LruCache<int, std::shared_ptr<int>> shared(2);
+    std::shared_ptr<int> first = std::make_shared<int>(1);
+    shared.put(1, first);
+    shared.put(1, std::make_shared<int>(2));
+    CHECK(first.use_count() == 1);
+}
+
+void testNearCache() {
+    std::cout << "--- near cache ---" << std::endl;
+    Cache::HashLruCaches<int, std::string> cache(64, 4, true);
+    std::string value;
+    cache.put(1, "a");
+    CHECK(cache.get(1, value) && value == "a");
+    CHECK(cache.get(1, value) && value == "a");     // served from the near cache
+    cache.put(1, "b");
+    CHECK(cache.get(1, value) && value == "b");
+    CHECK(cache.remove(1));
+    CHECK(!cache.get(1, value));
+    cache.put(2, "c", 9);
+    CHECK(cache.get(2, value));
+    cache.invalidateTag(9);
+    CHECK(!cache.get(2, value));
+    cache.put(3, "d");
+    CHECK(cache.get(3, value));
+    cache.purge();
+    CHECK(!cache.get(3, value));
+
+    // the per-thread copy must not outlive remove/purge or the cache itself
+    std::weak_ptr<int> watched;
+    {
+        Cache::HashLruCaches<int, std::shared_ptr<int>> shared(64, 4, true);
+        std::shared_ptr<int> item = std::make_shared<int>(1);
+        watched = item;
+        shared.put(1, item);
+        shared.get(1, item);
+        shared.get(1, item);
+        item.reset();
+        shared.remove(1);
+        shared.get(1, item);
+        CHECK(watched.expired());
+
+        item = std::make_shared<int>(2);
+        watched = item;
+        shared.put(2, item);
+        shared.get(2, item);
+        item.reset();
+        shared.purge();
+        shared.get(2, item);
+        CHECK(watched.expired());
+
+        item = std::make_shared<int>(3);
+        watched = item;
+        shared.put(3, item);
+        shared.get(3, item);
+        item.reset();
+    }
+    CHECK(watched.expired());
+}
+
+void testBulkLoad() {
+    std::cout << "--- bulkLoad ---" << std::endl;
+    std::string value;
+    std::vector<std::pair<int, std::string>> items;
+    for(int i = 1; i <= 5; i++) {
+        items.emplace_back(i, "v" + std::to_string(i));
+    }
+
+    // last entries end up most recent, as with put in order
+    Cache::LruCache<int, std::string> lru(3);
+    lru.bulkLoad(items.begin(), items.end());
+    CHECK(!lru.get(1, value) && !lru.get(2, value));
+    CHECK(lru.get(4, value) && lru.get(5, value));
+    lru.put(6, "v6");
+    CHECK(!lru.get(3, value) && lru.get(5, value) && value == "v5");
+
+    // entries that cannot survive are never allocated; a cached one among them is dropped
+    Cache::LruCache<int, std::string> big(100);
+    std::vector<Removal> log;
+    recordRemovals(big, log);
+    big.put(0, "old");
+    items.clear();
+    for(int i = 0; i < 100000; i++) {
+        items.emplace_back(i, std::to_string(i));
+    }
+    big.bulkLoad(items.begin(), items.end());
+    CHECK(log.size() == 1 && std::get<0>(log[0]) == 0 && std::get<2>(log[0]) == Cache::RemovalCause::Size);
+    CHECK(!big.get(0, value) && !big.get(99899, value));
+    CHECK(big.get(99900, value) && value == "99900" && big.get(99999, value));
+
+    // duplicate keys count once: the survivors are the last capacity distinct keys
+    Cache::LruCache<int, std::string> dup(2);
+    std::vector<std::pair<int, std::string>> repeated = {{1, "1"}, {2, "2"}, {3, "3"}, {3, "4"}};
+    dup.bulkLoad(repeated.begin(), repeated.end());
+    CHECK(!dup.get(1, value) && dup.get(2, value) && dup.get(3, value) && value == "4");
+    Cache::HashLruCaches<int, std::string> dupShards(4, 2);     // two slices of two, by key parity
+    repeated = {{0, "0"}, {1, "1"}, {2, "2"}, {3, "3"}, {4, "4"}, {5, "5"}, {4, "4b"}, {5, "5b"}};
+    dupShards.bulkLoad(repeated.begin(), repeated.end());
+    CHECK(!dupShards.get(0, value) && !dupShards.get(1, value));
+    CHECK(dupShards.get(2, value) && dupShards.get(3, value) && dupShards.get(4, value) && value == "4b" && dupShards.get(5, value));
+
+    Cache::HashLruCaches<int, std::string> sharded(400, 4);
+    sharded.bulkLoad(items.begin(), items.end());
+    int hits = 0;
+    for(int i = 0; i < 100000; i++) {
+        if(sharded.get(i, value)) {
+            CHECK(value == std::to_string(i));
+            hits++;
+        }
+    }
+    CHECK(hits > 0 && hits <= 400);
+    CHECK(sharded.get(99999, value));
+
+    // initial LFU frequency decides the victims
+    Cache::LfuCache<int, std::string> lfu(3);
+    std::vector<std::pair<int, std::string>> ranked = {{1, "a"}, {2, "b"}, {3, "c"}, {4, "d"}};
+    lfu.bulkLoad(ranked.begin(), ranked.end(), [](const int& key, const std::string&) {return key;});
+    CHECK(!lfu.get(1, value));      // lowest frequency, skipped
+    lfu.put(10, "x");               // evicts 2
+    CHECK(!lfu.get(2, value) && lfu.get(3, value) && lfu.get(4, value) && lfu.get(10, value));
+
+    // huge frequencies are clamped instead of overflowing the running total
+    Cache::LfuCache<int, std::string> hot(1000, 5000);
+    items.resize(1000);
+    hot.bulkLoad(items.begin(), items.end(), [](const int&, const std::string&) {return 1LL << 40;});
+    CHECK(hot.get(999, value));
+
+    // a failing slice surfaces to the caller instead of terminating
+    bool caught = false;
+    try {
+        Cache::forEachSliceParallel(8, [](size_t slice) {
+            if(slice == 3) {
+                throw std::runtime_error("slice failed");
+            }
+        });
+    }
+    catch(const std::runtime_error&) {
+        caught = true;
+    }
+    CHECK(caught);
+}
+
+void testPurgeAndTags() {
+    std::cout << "--- purge / tags ---" << std::endl;
+    std::string value;
+
+    Cache::LruCache<int, std::string> lru(4);
+    std::vector<Removal> log;
+    recordRemovals(lru, log);
+    lru.put(1, "a");
+    lru.put(2, "b", 5);
+    lru.purge();
+    CHECK(!lru.get(1, value) && !lru.get(2, value));
+    CHECK(log.size() == 2 && std::get<2>(log[0]) == Cache::RemovalCause::Expired);
+    lru.put(1, "a2");
+    CHECK(lru.get(1, value) && value == "a2");
+
+    // only the invalidated tag turns into misses; re-putting it makes it valid again
+    lru.put(2, "b", 5);
+    lru.put(3, "c", 6);
+    lru.invalidateTag(5);
+    CHECK(!lru.get(2, value) && lru.get(3, value) && lru.get(1, value));
+    lru.put(2, "b2", 5);
+    CHECK(lru.get(2, value) && value == "b2");
+
+    // one purge/invalidateTag reaches every slice of a sharded cache
+    Cache::HashLfuCache<int, std::string> lfuShards(64, 4);
+    for(int i = 0; i < 32; i++) {
+        lfuShards.put(i, "v", i % 2 ? 9 : Cache::kNoTag);
+    }
+    lfuShards.invalidateTag(9);
+    int hits = 0;
+    for(int i = 0; i < 32; i++) {
+        hits += lfuShards.get(i, value);
+    }
+    CHECK(hits == 16);
+    lfuShards.purge();
+    hits = 0;
+    for(int i = 0; i < 32; i++) {
+        hits += lfuShards.get(i, value);
+    }
+    CHECK(hits == 0);
+
+    // invalidated LFU entries keep their frequency but must not hold on to capacity
+    Cache::LfuCache<int, std::string> lfu(4);
+    for(int key = 0; key < 3; key++) {
+        lfu.put(key, "tagged", 3);
+        for(int i = 0; i < 50; i++) {
+            lfu.get(key, value);
+        }
+    }
+    lfu.invalidateTag(3);
+    hits = 0;
+    for(int round = 0; round < 100; round++) {
+        for(int key = 10; key < 14; key++) {
+            if(lfu.get(key, value)) {
+                hits++;
+            }
+            else {
+                lfu.put(key, "live");
+            }
+        }
+    }
+    CHECK(hits >= 396);
+
+    // an invalidation that has fallen out of the log still gets the entries reclaimed
+    Cache::LfuCache<int, std::string> busy(4);
+    for(int key = 0; key < 3; key++) {
+        busy.put(key, "tagged", 4);
+        for(int i = 0; i < 50; i++) {
+            busy.get(key, value);
+        }
+    }
+    busy.invalidateTag(4);
+    for(Cache::CacheTag tag = 100; tag < 1100; tag++) {
+        busy.invalidateTag(tag);
+    }
+    busy.put(10, "a");
+    busy.put(11, "b");
+    busy.put(12, "c");
+    CHECK(busy.get(10, value) && busy.get(11, value) && busy.get(12, value));
+
+    // the log reports each invalidated slot once, in order
+    Cache::GenerationTable table;
+    uint64_t seen = table.invalidations();
+    table.invalidate(7);
+    table.invalidate(4096 + 9);
+    std::vector<size_t> slots;
+    CHECK(table.forEachInvalidatedSlot(seen, [&slots](size_t slot) {slots.push_back(slot);}));
+    CHECK(slots == std::vector<size_t>({7, 9}) && seen == 2);
+    CHECK(table.forEachInvalidatedSlot(seen, [&slots](size_t slot) {slots.push_back(slot);}) && slots.size() == 2);
+
+    // tag counters are only allocated once a tag is invalidated
+    CHECK(sizeof(Cache::GenerationTable) <= 64);
+}
+
+void testClock() {
+    std::cout << "--- clock ---" << std::endl;
+    std::string value;
+
+    // a slot freed by remove is reused before anything live is evicted
+    Cache::ClockCache<int, std::string> clock(4);
+    for(int key = 0; key < 4; key++) {
+        clock.put(key, std::to_string(key));
+    }
+    CHECK(clock.remove(3));
+    clock.put(10, "10");
+    CHECK(clock.get(0, value) && clock.get(1, value) && clock.get(2, value) && clock.get(10, value));
+    clock.put(11, "11");            // now full: the hand evicts one entry
+    int hits = 0;
+    for(int key : {0, 1, 2, 10, 11}) {
+        hits += clock.get(key, value);
+    }
+    CHECK(hits == 4);
+
+    Cache::ClockProCache<int, std::string> clockPro(4);
+    for(int key = 0; key < 4; key++) {
+        clockPro.put(key, std::to_string(key));
+    }
+    CHECK(clockPro.remove(3));
+    clockPro.put(10, "10");
+    CHECK(clockPro.get(0, value) && clockPro.get(1, value) && clockPro.get(2, value) && clockPro.get(10, value));
+
+    std::vector<Removal> log;
+    recordRemovals(clock, log);
+    clock.purge();
+    CHECK(!clock.get(11, value));
+    for(int key = 20; key < 24; key++) {
+        clock.put(key, "new");
+    }
+    CHECK(log.size() == 4);         // purged slots reported as they are reused
+    for(const auto& entry : log) {
+        CHECK(std::get<2>(entry) == Cache::RemovalCause::Expired);
+    }
+}
+
+int main() {
+    testRemovalListener();
+    testNearCache();
+    testBulkLoad();
+    testPurgeAndTags();
+    testClock();
+    std::cout << (failures == 0 ? "all checks passed" : "some checks failed") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -9,6 +9,7 @@
 #include "CachePolicy.h"
 #include "LruCache.h"
 #include "LfuCache.h"
+#include "ClockCache.h"
 
 class Timer {
     public:
@@ -27,7 +28,7 @@ void printResults(const std::string& testName, int capacity, const std::vector<i
     std::cout<< "cache size: " << capacity <<std::endl;
 
     std::vector<std::string> names;
-    names = {"LRU", "LFU", "KLRU", "LFU Aging"};
+    names = {"LRU", "LFU", "KLRU", "LFU Aging", "CLOCK", "CLOCK-Pro"};
     for(size_t i = 0; i< hits.size(); i++) {
         double hitRate = 100.0 * hits[i] / get_operations[i];
         std::cout<< (i < names.size()? names[i]: "Algorithm " + std::to_string(i+1)) << " - hit rate: " << std::fixed << std::setprecision(2) << hitRate << "%";
@@ -49,14 +50,16 @@ void testHotDataAccess() {
     Cache::LfuCache<int, std::string> lfu(CAPACITY);
     Cache::LruKCache<int, std::string> klru(CAPACITY, HOT_KEYS + COLD_KEYS, 2);
     Cache::LfuCache<int, std::string> lfuAging(CAPACITY, 20000);
+    Cache::ClockCache<int, std::string> clock(CAPACITY);
+    Cache::ClockProCache<int, std::string> clockPro(CAPACITY);
 
     std::random_device rd;
     std::mt19937 gen(rd());
     
-    std::vector<Cache::CachePolicy<int, std::string>*> caches = {&lru, &lfu, &klru, &lfuAging};
-    std::vector<int> hits(4, 0);
-    std::vector<int> get_operations(4, 0);
-    std::vector<std::string> names = {"LRU", "LFU", "KLRU", "LFU Aging"};
+    std::vector<Cache::CachePolicy<int, std::string>*> caches = {&lru, &lfu, &klru, &lfuAging, &clock, &clockPro};
+    std::vector<int> hits(6, 0);
+    std::vector<int> get_operations(6, 0);
+    std::vector<std::string> names = {"LRU", "LFU", "KLRU", "LFU Aging", "CLOCK", "CLOCK-Pro"};
 
     for(int i = 0; i < caches.size(); i++) {
         for(int key = 0; key< HOT_KEYS; key++) {
@@ -104,11 +107,13 @@ void testLoopPattern() {
     Cache::LfuCache<int, std::string> lfu(CAPACITY);
     Cache::LruKCache<int, std::string> klru(CAPACITY, LOOP_SIZE * 2, 2);
     Cache::LfuCache<int, std::string> lfuAging(CAPACITY, 3000);
+    Cache::ClockCache<int, std::string> clock(CAPACITY);
+    Cache::ClockProCache<int, std::string> clockPro(CAPACITY);
 
-    std::vector<Cache::CachePolicy<int, std::string>*> caches = {&lru, &lfu, &klru, &lfuAging};
-    std::vector<int> hits(4, 0);
-    std::vector<int> get_operations(4, 0);
-    std::vector<std::string> names = {"LRU", "LFU", "KLRU", "LFU Aging"};
+    std::vector<Cache::CachePolicy<int, std::string>*> caches = {&lru, &lfu, &klru, &lfuAging, &clock, &clockPro};
+    std::vector<int> hits(6, 0);
+    std::vector<int> get_operations(6, 0);
+    std::vector<std::string> names = {"LRU", "LFU", "KLRU", "LFU Aging", "CLOCK", "CLOCK-Pro"};
 
     std::random_device rd;
     std::mt19937 gen(rd());
@@ -164,11 +169,13 @@ void testWorkloadShift() {
     Cache::LfuCache<int, std::string> lfu(CAPACITY);
     Cache::LruKCache<int, std::string> klru(CAPACITY, 500, 2);
     Cache::LfuCache<int, std::string> lfuAging(CAPACITY, 10000);
+    Cache::ClockCache<int, std::string> clock(CAPACITY);
+    Cache::ClockProCache<int, std::string> clockPro(CAPACITY);
 
-    std::vector<Cache::CachePolicy<int, std::string>*> caches = {&lru, &lfu, &klru, &lfuAging};
-    std::vector<int> hits(4, 0);
-    std::vector<int> get_operations(4, 0);
-    std::vector<std::string> names = {"LRU", "LFU", "KLRU", "LFU Aging"};
+    std::vector<Cache::CachePolicy<int, std::string>*> caches = {&lru, &lfu, &klru, &lfuAging, &clock, &clockPro};
+    std::vector<int> hits(6, 0);
+    std::vector<int> get_operations(6, 0);
+    std::vector<std::string> names = {"LRU", "LFU", "KLRU", "LFU Aging", "CLOCK", "CLOCK-Pro"};
 
     std::random_device rd;
     std::mt19937 gen(rd());
@@ -0,0 +1,145 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "MemcachedServer.h"
+
+// protocol checks for MemcachedServer over a unix socket; loadGen covers throughput
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if(!(cond)) { \
+            std::cout << "  FAILED " << __FILE__ << ":" << __LINE__ << ": " #cond << std::endl; \
+            failures++; \
+        } \
+    } while(0)
+
+static const std::string kVersionLine = "VERSION 1.6.0-cache-system\r\n";
+
+int connectTo(const std::string& path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    if(fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while(sent < data.size()) {
+        ssize_t n = write(fd, data.data() + sent, data.size() - sent);
+        if(n <= 0) {
+            return;
+        }
+        sent += static_cast<size_t>(n);
+    }
+}
+
+// sends the request followed by "version" and returns everything answered before
+// the VERSION line, so a missing or extra reply shows up in the result
+std::string roundTrip(int fd, const std::string& request) {
+    sendAll(fd, request + "version\r\n");
+    std::string reply;
+    char buffer[4096];
+    while(reply.size() < kVersionLine.size() || reply.compare(reply.size() - kVersionLine.size(), kVersionLine.size(), kVersionLine) != 0) {
+        pollfd pfd{fd, POLLIN, 0};
+        if(poll(&pfd, 1, 2000) <= 0) {
+            return reply + "<timeout>";
+        }
+        ssize_t got = read(fd, buffer, sizeof(buffer));
+        if(got <= 0) {
+            return reply + "<closed>";
+        }
+        reply.append(buffer, static_cast<size_t>(got));
+    }
+    return reply.substr(0, reply.size() - kVersionLine.size());
+}
+
+void testSetAndGet(int fd) {
+    std::cout << "--- set / get ---" << std::endl;
+    CHECK(roundTrip(fd, "set a 5 0 3\r\nabc\r\n") == "STORED\r\n");
+    CHECK(roundTrip(fd, "get a missing\r\n") == "VALUE a 5 3\r\nabc\r\nEND\r\n");
+    CHECK(roundTrip(fd, "delete a\r\ndelete a\r\n") == "DELETED\r\nNOT_FOUND\r\n");
+    CHECK(roundTrip(fd, "set a 0 0 3 noreply\r\nabc\r\n").empty());
+
+    // pipelined requests spanning several reads are all answered, in order
+    std::string request;
+    std::string expected;
+    for(int i = 0; i < 5000; i++) {
+        request += "get a\r\n";
+        expected += "VALUE a 0 3\r\nabc\r\nEND\r\n";
+    }
+    CHECK(roundTrip(fd, request) == expected);
+}
+
+void testBadRequests(int fd) {
+    std::cout << "--- bad requests ---" << std::endl;
+    const std::string badFormat = "CLIENT_ERROR bad command line format\r\n";
+
+    // lengths that overflow, are negative or exceed INT32_MAX never start a data block
+    CHECK(roundTrip(fd, "set k 0 0 99999999999999999999\r\n") == badFormat);
+    CHECK(roundTrip(fd, "set k 0 0 18446744073709551616\r\n") == badFormat);
+    CHECK(roundTrip(fd, "set k 0 0 -1\r\n") == badFormat);
+    CHECK(roundTrip(fd, "set k 0 0 4294967296\r\n") == badFormat);
+    CHECK(roundTrip(fd, "set k 4294967296 0 1\r\n") == badFormat);
+
+    // the rest of a bad chunk is dropped up to its newline, the next command still runs
+    CHECK(roundTrip(fd, "set k 0 0 3\r\nabcdef\r\nget k\r\n") == "CLIENT_ERROR bad data chunk\r\nEND\r\n");
+
+    // an oversized key anywhere in a multi-key get fails the whole request, before any VALUE
+    CHECK(roundTrip(fd, "set a 0 0 1\r\nx\r\n") == "STORED\r\n");
+    CHECK(roundTrip(fd, "get a " + std::string(251, 'k') + " a\r\n") == badFormat);
+    CHECK(roundTrip(fd, "get a\r\n") == "VALUE a 0 1\r\nx\r\nEND\r\n");
+
+    // a value above maxValueSize is swallowed even when it arrives over several reads
+    sendAll(fd, "set big 0 0 32\r\n" + std::string(20, 'v'));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(roundTrip(fd, std::string(12, 'v') + "\r\nget big\r\n") == "SERVER_ERROR object too large for cache\r\nEND\r\n");
+
+    CHECK(roundTrip(fd, "bogus\r\n\r\n") == "ERROR\r\nERROR\r\n");
+}
+
+void testFlush(int fd) {
+    std::cout << "--- flush_all ---" << std::endl;
+    CHECK(roundTrip(fd, "set a 0 0 1\r\nx\r\nflush_all noreply\r\nget a\r\n") == "STORED\r\nEND\r\n");
+    CHECK(roundTrip(fd, "set a 0 0 1\r\nx\r\nflush_all\r\nget a\r\n") == "STORED\r\nOK\r\nEND\r\n");
+}
+
+int main() {
+    std::string path = "/tmp/cache-test-" + std::to_string(getpid()) + ".sock";
+    Cache::ShardedItemStore<Cache::HashLruCaches<std::string, Cache::CacheItemPtr>> store(1024, 4);
+    Cache::ServerOptions options;
+    options.port = 0;
+    options.unixPath = path;
+    options.threads = 1;
+    options.maxValueSize = 16;
+    Cache::MemcachedServer server(store, options);
+    if(!server.start()) {
+        std::cout << "server failed to start" << std::endl;
+        return 1;
+    }
+
+    int fd = connectTo(path);
+    CHECK(fd >= 0);
+    if(fd >= 0) {
+        testSetAndGet(fd);
+        testBadRequests(fd);
+        testFlush(fd);
+        close(fd);
+    }
+    server.stop();
+    server.wait();
+    std::cout << (failures == 0 ? "all checks passed" : "some checks failed") << std::endl;
+    return failures == 0 ? 0 : 1;
+}